@@ -2,11 +2,39 @@
 
 layout(location = 0) in vec2 texture_coord;
 
+// Batched programs read the layer of the image being drawn
+#ifdef LAYERED
+uniform sampler2DArray texture_image;
+uniform sampler2DArray edge_image;
+flat in int layer;
+#define SAMPLE(image, coord) texture(image, vec3(coord, layer))
+#else
 uniform sampler2D texture_image;
 uniform sampler2D edge_image;
+#define SAMPLE(image, coord) texture(image, coord)
+#endif
 
 uniform int flip;
-uniform int color_levels;
+
+// Nearest palette color of each cell, the cells split every channel
+// in 32 intervals. Used instead of the uniform levels when defined
+#ifdef PALETTE
+uniform sampler3D palette;
+#endif
+
+// Filter parameters shared by all the passes
+layout(std140) uniform FilterParameters
+{
+	ivec2 imageSize;
+	int thresholdRadius;
+	int dilationRadius;
+	int colorLevels;
+};
+
+// Specialized programs have the number of levels compiled in
+#ifndef COLOR_LEVELS
+#define COLOR_LEVELS colorLevels
+#endif
 
 layout(location = 0) out vec4 out_color;
 
@@ -18,9 +46,22 @@ void main()
 		flipped_coord.y = 1 - texture_coord.y;
 	}
 
-	// Subtract the edges t make them black
-	out_color = texture(texture_image, flipped_coord) - texture(edge_image, flipped_coord);
+	// Subtract the edges t make them black, the edge mask
+	// is stored in a single channel texture. Alpha is kept
+	// from the image, the saved results have all 4 channels
+	vec4 color = SAMPLE(texture_image, flipped_coord);
+	float edge = SAMPLE(edge_image, flipped_coord).r;
+	out_color = vec4(color.rgb - edge, color.a);
+
+#ifdef PALETTE
+	// Look up the palette color of the cell of the 8 bit color
+	ivec3 cell = ivec3(clamp(out_color.rgb, 0, 1) * 255 + 0.5) >> 3;
+	out_color.rgb = texelFetch(palette, cell, 0).rgb;
 
+	// The palette color of black isn't always black, the edges stay black
+	out_color.rgb *= step(edge, 0.5);
+#else
 	// Assign the color to the nearest level
-	out_color = floor(out_color * color_levels) / color_levels;
+	out_color.rgb = floor(out_color.rgb * COLOR_LEVELS) / COLOR_LEVELS;
+#endif
 }
\ No newline at end of file
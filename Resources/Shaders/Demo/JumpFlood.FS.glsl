@@ -0,0 +1,70 @@
+#version 410
+
+// Batched programs read the layer of the image being drawn
+#ifdef LAYERED
+uniform sampler2DArray seed_image;
+flat in int layer;
+#define TEXEL(image, pixel) texelFetch(image, ivec3(pixel, layer), 0)
+#else
+uniform sampler2D seed_image;
+#define TEXEL(image, pixel) texelFetch(image, pixel, 0)
+#endif
+uniform int jump_step;
+
+// Filter parameters shared by all the passes
+layout(std140) uniform FilterParameters
+{
+	ivec2 imageSize;
+	int thresholdRadius;
+	int dilationRadius;
+	int colorLevels;
+};
+
+layout(location = 0) out vec4 out_color;
+
+// Same seed encoding as in JumpFloodSeed.FS.glsl
+const float MAX_COORD = 65535.0f;
+
+// Chebyshev distance, so that the outline keeps the square
+// shape of the old (2 * radius + 1)^2 dilation kernel
+float distance_to(vec2 seed, vec2 pixel)
+{
+	vec2 delta = abs(seed - pixel);
+	return max(delta.x, delta.y);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+	vec2 best_seed = vec2(MAX_COORD);
+	float best_distance = 0;
+
+	// Look at the 8 neighbours found at the current jump distance
+	for (int i = -1; i <= 1; i++)
+	{
+		for (int j = -1; j <= 1; j++)
+		{
+			ivec2 neighbour = pixel + ivec2(i, j) * jump_step;
+
+			if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, imageSize)))
+				continue;
+
+			vec2 seed = round(TEXEL(seed_image, neighbour).xy * MAX_COORD);
+
+			// The neighbour did not reach any edge yet
+			if (seed.x == MAX_COORD)
+				continue;
+
+			// Keep the closest seed
+			float dist = distance_to(seed, pixel);
+			if (best_seed.x == MAX_COORD || dist < best_distance)
+			{
+				best_seed = seed;
+				best_distance = dist;
+			}
+		}
+	}
+
+	out_color = vec4(best_seed / MAX_COORD, 0, 0);
+}
@@ -0,0 +1,32 @@
+#version 410
+
+// Batched programs read the layer of the image being drawn
+#ifdef LAYERED
+uniform sampler2DArray binary_image;
+flat in int layer;
+#define TEXEL(image, pixel) texelFetch(image, ivec3(pixel, layer), 0)
+#else
+uniform sampler2D binary_image;
+#define TEXEL(image, pixel) texelFetch(image, pixel, 0)
+#endif
+
+layout(location = 0) out vec4 out_color;
+
+// Seeds are stored in a 16 bit normalized target,
+// the largest value is used to mark a missing seed
+const float MAX_COORD = 65535.0f;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+	// Every edge pixel is its own closest seed, the rest have no seed yet
+	if (TEXEL(binary_image, pixel).r > 0.5f)
+	{
+		out_color = vec4(pixel / MAX_COORD, 0, 0);
+	}
+	else
+	{
+		out_color = vec4(1);
+	}
+}
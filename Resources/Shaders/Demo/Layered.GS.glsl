@@ -0,0 +1,24 @@
+#version 410
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+layout(location = 0) in vec2 vertex_texture_coord[];
+flat in int instance[];
+
+layout(location = 0) out vec2 texture_coord;
+flat out int layer;
+
+// Sends each instance of the quad to the layer of its image
+void main()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		texture_coord = vertex_texture_coord[i];
+		layer = instance[i];
+		gl_Layer = instance[i];
+		gl_Position = gl_in[i].gl_Position;
+		EmitVertex();
+	}
+	EndPrimitive();
+}
@@ -0,0 +1,42 @@
+#version 410
+
+// Batched programs read the layer of the image being drawn
+#ifdef LAYERED
+uniform sampler2DArray seed_image;
+flat in int layer;
+#define TEXEL(image, pixel) texelFetch(image, ivec3(pixel, layer), 0)
+#else
+uniform sampler2D seed_image;
+#define TEXEL(image, pixel) texelFetch(image, pixel, 0)
+#endif
+
+// Filter parameters shared by all the passes
+layout(std140) uniform FilterParameters
+{
+	ivec2 imageSize;
+	int thresholdRadius;
+	int dilationRadius;
+	int colorLevels;
+};
+
+layout(location = 0) out vec4 out_color;
+
+// Same seed encoding as in JumpFloodSeed.FS.glsl
+const float MAX_COORD = 65535.0f;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec2 seed = round(TEXEL(seed_image, pixel).xy * MAX_COORD);
+
+	// No edge was found in range
+	if (seed.x == MAX_COORD)
+	{
+		out_color = vec4(0);
+		return;
+	}
+
+	// Threshold the distance to the closest edge to get the outline
+	vec2 delta = abs(seed - pixel);
+	out_color = max(delta.x, delta.y) <= dilationRadius ? vec4(1) : vec4(0);
+}
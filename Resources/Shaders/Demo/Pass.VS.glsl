@@ -6,8 +6,16 @@ layout(location = 2) in vec2 v_texture_coord;
 
 layout(location = 0) out vec2 texture_coord;
 
+#ifdef LAYERED
+// Each instance is sent to its own layer by the geometry shader
+flat out int instance;
+#endif
+
 void main()
 {
 	texture_coord = v_texture_coord;
+#ifdef LAYERED
+	instance = gl_InstanceID;
+#endif
 	gl_Position = vec4(v_position, 1.0);
 }
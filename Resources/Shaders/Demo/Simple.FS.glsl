@@ -6,6 +6,9 @@ uniform sampler2D texture_image;
 
 uniform int flip;
 
+// Part of the image shown, offset and size in texture coordinates
+uniform vec4 view_rect;
+
 layout(location = 0) out vec4 out_color;
 
 void main()
@@ -16,5 +19,5 @@ void main()
 		flipped_coord.y = 1 - texture_coord.y;
 	}
 
-	out_color = texture(texture_image, flipped_coord);
+	out_color = texture(texture_image, view_rect.xy + flipped_coord * view_rect.zw);
 }
\ No newline at end of file
@@ -2,14 +2,35 @@
 
 layout(location = 0) in vec2 texture_coord;
 
+// Batched programs read the layer of the image being drawn
+#ifdef LAYERED
+uniform sampler2DArray texture_image;
+flat in int layer;
+#define SAMPLE(image, coord) texture(image, vec3(coord, layer))
+#else
 uniform sampler2D texture_image;
-uniform ivec2 screenSize;
-uniform int threshold_radius;
+#define SAMPLE(image, coord) texture(image, coord)
+#endif
+
+// Filter parameters shared by all the passes
+layout(std140) uniform FilterParameters
+{
+	ivec2 imageSize;
+	int thresholdRadius;
+	int dilationRadius;
+	int colorLevels;
+};
+
+// Specialized programs have the radius compiled in, so the loops have
+// constant bounds and can be unrolled by the driver
+#ifndef THRESHOLD_RADIUS
+#define THRESHOLD_RADIUS thresholdRadius
+#endif
 
 layout(location = 0) out vec4 out_color;
 
 int sobel_kernel[9] = int[](-1, 0, 1, -2, 0, 2, -1, 0, 1);
-vec2 texelSize = 1.0f / screenSize;
+vec2 texelSize = 1.0f / imageSize;
 
 // Converts the color to grayscale
 vec4 grayscale(vec4 color)
@@ -34,8 +55,8 @@ vec4 sobel()
 
 			// Compute Dx and Dy
 			// Convert the image to grayscale for better results
-			sum_x += sobel_kernel[kernel_i * 3 + kernel_j] * grayscale(texture(texture_image, texture_coord + vec2(i, j) * texelSize));
-			sum_y += sobel_kernel[kernel_j * 3 + kernel_i] * grayscale(texture(texture_image, texture_coord + vec2(i, j) * texelSize));
+			sum_x += sobel_kernel[kernel_i * 3 + kernel_j] * grayscale(SAMPLE(texture_image, texture_coord + vec2(i, j) * texelSize));
+			sum_y += sobel_kernel[kernel_j * 3 + kernel_i] * grayscale(SAMPLE(texture_image, texture_coord + vec2(i, j) * texelSize));
 		}
 	}
 
@@ -43,18 +64,18 @@ vec4 sobel()
 }
 
 // Compute the average value of area on the selected channel
-float avg(int channel, int radius)
+float avg(int channel)
 {
 	float sum = 0;
-	for (int i = -radius; i <= radius; i++)
+	for (int i = -THRESHOLD_RADIUS; i <= THRESHOLD_RADIUS; i++)
 	{
-		for (int j = -radius; j <= radius; j++)
+		for (int j = -THRESHOLD_RADIUS; j <= THRESHOLD_RADIUS; j++)
 		{
-			sum += grayscale(texture(texture_image, texture_coord + vec2(i, j) * texelSize))[channel];
+			sum += grayscale(SAMPLE(texture_image, texture_coord + vec2(i, j) * texelSize))[channel];
 		}
 	}
 	
-	float samples = pow((2 * radius + 1), 2);
+	float samples = pow((2 * THRESHOLD_RADIUS + 1), 2);
 	return sum / samples;
 }
 
@@ -64,5 +85,5 @@ void main()
 	out_color = sobel();
 
 	// Binarize output based on a local threshold
-	out_color = out_color[0] < avg(0, threshold_radius)? vec4(0.0f) : vec4(1.0f);
+	out_color = out_color[0] < avg(0)? vec4(0.0f) : vec4(1.0f);
 }
\ No newline at end of file
@@ -1,18 +1,55 @@
 #include "CartoonFilterDemo.h"
 
-#include <CartoonFilter\Region.h>
-
+#include <cmath>
 #include <vector>
+#include <chrono>
+#include <future>
 #include <iostream>
 
+#include <stb/stb_image.h>
+
+namespace
+{
+	// Zoom of each scroll step, up to the zoom where a pixel
+	// of the image covers this many pixels of the window
+	const float ZOOM_STEP = 1.25f;
+	const float MAX_PIXEL_ZOOM = 8.0f;
+
+	// Parameters of the filter when the demo starts
+	const CpuPipeline::Parameters DEFAULT_PARAMETERS = { 5, 1, CpuPipeline::SEGMENTATION, 7, 16 };
+}
+
 CartoonFilterDemo::CartoonFilterDemo()
 {
-	colorLevels = 7;
-	localThresholdRadius = 5;
-	dilationRadius = 1;
+	colorLevels = DEFAULT_PARAMETERS.colorLevels;
+	localThresholdRadius = DEFAULT_PARAMETERS.thresholdRadius;
+	dilationRadius = DEFAULT_PARAMETERS.dilationRadius;
 	mode = Mode::CPU;
+	paletteColors = DEFAULT_PARAMETERS.paletteColors;
+	cpuColoring = DEFAULT_PARAMETERS.coloring;
+	gpuColoring = Coloring::LEVELS;
+	paletteChanged = true;
+	shownProgress = -1;
+	cpuShownImage = nullptr;
+	originalImage = nullptr;
+	processedImage = nullptr;
+	tileViewRect = glm::ivec4(0);
+	tileViewLevel = -1;
+	tileViewChanged = true;
+	zoom = 1;
+	viewCenter = glm::vec2(0.5f);
 	processed = true;
+	gpuProcessed = false;
 	windowSize = glm::ivec2(1280, 720);
+
+	quad = nullptr;
+	basicShader = nullptr;
+	sobelShader = nullptr;
+	seedShader = nullptr;
+	floodShader = nullptr;
+	outlineShader = nullptr;
+	cartoonShader = nullptr;
+	memset(&layeredPrograms, 0, sizeof(layeredPrograms));
 }
 
 CartoonFilterDemo::~CartoonFilterDemo()
@@ -21,17 +58,32 @@ CartoonFilterDemo::~CartoonFilterDemo()
 
 void CartoonFilterDemo::Init()
 {
-	// Init frame buffers ----------------------------------------------------------
-	glm::vec2 resolution = window->GetResolution();
-	sobelBuffer = std::unique_ptr<FrameBuffer>(new FrameBuffer());
-	sobelBuffer->Generate(resolution.x, resolution.y, 1);	
-	
-	edgeBuffer = std::unique_ptr<FrameBuffer>(new FrameBuffer());
-	edgeBuffer->Generate(resolution.x, resolution.y, 1);
+	InitFilter();
+	cpuWorker = std::unique_ptr<CpuFilterWorker>(new CpuFilterWorker());
+	cpuPreview = std::unique_ptr<Texture2D>(new Texture2D());
+	tiledFilter = std::unique_ptr<TiledFilter>(new TiledFilter());
+	tileView = std::unique_ptr<Texture2D>(new Texture2D());
 
 	// Implicit image --------------------------------------------------------------
 	SelectImage();
 
+	// Nothing changes on screen without user input
+	SetWaitForEvents(true);
+}
+
+void CartoonFilterDemo::InitFilter()
+{
+	// Init frame buffers ----------------------------------------------------------
+	// The intermediate targets of the passes are taken from the pool when the
+	// filter runs. None of the passes use depth testing, so no depth attachment
+	// is created. The result is resized to the image resolution once one is loaded
+	glm::vec2 resolution = window->GetResolution();
+	renderTargets = std::unique_ptr<RenderTargetPool>(new RenderTargetPool());
+
+	// Cached output of the GPU filter, mipmapped because it's minified on screen
+	resultBuffer = std::unique_ptr<FrameBuffer>(new FrameBuffer());
+	resultBuffer->GenerateWithFormats(resolution.x, resolution.y, { GL_RGBA8 }, false, true);
+
 	// Load a simple quad mesh -----------------------------------------------------
 	{
 		Mesh* mesh = new Mesh("quad");
@@ -45,16 +97,30 @@ void CartoonFilterDemo::Init()
 		Shader *shader = new Shader("Sobel");
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Sobel.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
-	// Image dilatation shader -----------------------------------------------------
+	// Jump flood seeding shader ---------------------------------------------------
 	{
-		Shader *shader = new Shader("Dilation");
+		Shader *shader = new Shader("JumpFloodSeed");
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
-		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Dilate.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/JumpFloodSeed.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
+		shaders[shader->GetName()] = shader;
+	}
+
+	// Jump flood step shader ------------------------------------------------------
+	{
+		Shader *shader = new Shader("JumpFlood");
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/JumpFlood.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
+		shaders[shader->GetName()] = shader;
+	}
+
+	// Outline threshold shader ----------------------------------------------------
+	{
+		Shader *shader = new Shader("Outline");
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Outline.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
 		shaders[shader->GetName()] = shader;
 	}
 
@@ -63,7 +129,6 @@ void CartoonFilterDemo::Init()
 		Shader *shader = new Shader("Cartoon");
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Cartoon.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
@@ -72,9 +137,56 @@ void CartoonFilterDemo::Init()
 		Shader *shader = new Shader("Basic");
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
 		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Simple.FS.glsl").c_str(), GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
+
+	// Compile all the programs at once --------------------------------------------
+	Shader::CreateAndLinkAll({ shaders["Sobel"], shaders["JumpFloodSeed"], shaders["JumpFlood"],
+		shaders["Outline"], shaders["Cartoon"], shaders["Basic"] });
+
+	// Resources used by the passes ------------------------------------------------
+	quad = meshes["quad"];
+	basicShader = shaders["Basic"];
+	sobelShader = shaders["Sobel"];
+	seedShader = shaders["JumpFloodSeed"];
+	floodShader = shaders["JumpFlood"];
+	outlineShader = shaders["Outline"];
+	cartoonShader = shaders["Cartoon"];
+
+	// Filter parameters shared by the passes --------------------------------------
+	filterParameters = std::unique_ptr<UBO<FilterParameters>>(new UBO<FilterParameters>());
+	for (Shader *shader : { sobelShader, floodShader, outlineShader, cartoonShader })
+		shader->BindUniformBlock("FilterParameters", FILTER_PARAMETERS_BINDING);
+
+	// Lookup table of the adaptive palette, filled when the palette is used
+	paletteTexture = std::unique_ptr<Texture3D>(new Texture3D());
+}
+
+void CartoonFilterDemo::InitLayeredFilter()
+{
+	// The batched programs are the same passes compiled with LAYERED. A geometry
+	// shader sends each instance of the quad to the layer of its image
+	auto createLayered = [this](const char *name, const char *fragmentShader) {
+		Shader *shader = new Shader(name);
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Pass.VS.glsl").c_str(), GL_VERTEX_SHADER);
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/Layered.GS.glsl").c_str(), GL_GEOMETRY_SHADER);
+		shader->AddShader((RESOURCE_PATH::SHADERS + "Demo/" + fragmentShader).c_str(), GL_FRAGMENT_SHADER);
+		shader->SetDefine("LAYERED", "1");
+		shaders[shader->GetName()] = shader;
+		return shader;
+	};
+
+	layeredPrograms.sobel = createLayered("SobelLayered", "Sobel.FS.glsl");
+	layeredPrograms.seed = createLayered("JumpFloodSeedLayered", "JumpFloodSeed.FS.glsl");
+	layeredPrograms.flood = createLayered("JumpFloodLayered", "JumpFlood.FS.glsl");
+	layeredPrograms.outline = createLayered("OutlineLayered", "Outline.FS.glsl");
+	layeredPrograms.cartoon = createLayered("CartoonLayered", "Cartoon.FS.glsl");
+
+	Shader::CreateAndLinkAll({ layeredPrograms.sobel, layeredPrograms.seed, layeredPrograms.flood,
+		layeredPrograms.outline, layeredPrograms.cartoon });
+
+	for (Shader *shader : { layeredPrograms.sobel, layeredPrograms.flood, layeredPrograms.outline, layeredPrograms.cartoon })
+		shader->BindUniformBlock("FilterParameters", FILTER_PARAMETERS_BINDING);
 }
 
 void CartoonFilterDemo::FrameStart()
@@ -88,7 +200,7 @@ void CartoonFilterDemo::Update(float deltaTimeSeconds)
 	switch (mode)
 	{
 	case SIMPLE:
-		RenderImage(originalImage);
+		RenderImage(originalImage, GetViewRect());
 		break;
 	case GPU:
 		RenderOnGpu();
@@ -99,15 +211,17 @@ void CartoonFilterDemo::Update(float deltaTimeSeconds)
 	default:
 		break;
 	}
+
+	ShowCpuProgress();
 }
 
 void CartoonFilterDemo::FrameEnd()
 {
 }
 
-void CartoonFilterDemo::RenderImage(Texture2D *image)
+void CartoonFilterDemo::RenderImage(Texture2D *image, const glm::vec4 &textureRect)
 {
-	Shader *shader = shaders["Basic"];
+	Shader *shader = basicShader;
 
 	if (!image || !shader || !shader->program)
 		return;
@@ -115,463 +229,690 @@ void CartoonFilterDemo::RenderImage(Texture2D *image)
 	shader->Use();
 
 	// Flip the image coz tex_coords are inversed 
-	int flip_loc = shader->GetUniformLocation("flip");
-	glUniform1i(flip_loc, 1);
+	shader->SetUniform("flip", 1);
+	shader->SetUniform("view_rect", textureRect);
 
 	// Send image to shader
-	int locTexture = shader->GetUniformLocation("texture_image");
-	glUniform1i(locTexture, 0);
+	shader->SetUniform("texture_image", 0);
 	image->BindToTextureUnit(GL_TEXTURE0);
 
-	RenderMesh(meshes["quad"], shader, glm::mat4(1.0f));
+	RenderMesh(quad, shader, glm::mat4(1.0f));
 
 	image->UnBind();
 }
 
 void CartoonFilterDemo::RenderOnGpu()
-{	
-	sobelBuffer->Bind();
-	ClearScreen();
+{
+	// Process only when the image or the parameters change
+	if (!gpuProcessed)
+	{
+		gpuProcessed = true;
 
-	// Apply sobel to determine edges
-	ApplySobelGpu(originalImage);
+		if (gpuColoring == Coloring::PALETTE)
+			UpdatePalette();
 
-	edgeBuffer->Bind();
-	ClearScreen();
+		FilterOnGpu(originalImage);
 
-	// Dilate edges
-	DilateImageGpu(sobelBuffer->GetTexture(0));
+		// The result is minified when presented
+		resultBuffer->GetTexture(0)->GenerateMipmaps();
 
-	FrameBuffer::BindDefault();
-	ClearScreen();
+		FrameBuffer::BindDefault(window->GetResolution());
+	}
 
-	// Combine outline with the original image to apply the filter
-	ApplyCartoonShader(originalImage, edgeBuffer->GetTexture(0));
+	// Present the cached result scaled to the window
+	RenderImage(resultBuffer->GetTexture(0), GetViewRect());
 }
 
-void CartoonFilterDemo::ApplySobelGpu(Texture2D *image)
+void CartoonFilterDemo::UploadFilterParameters(const glm::ivec2 &imageSize)
 {
-	Shader *shader = shaders["Sobel"];
+	// Upload the parameters shared by all the passes
+	FilterParameters parameters = {};
+	parameters.imageSize = imageSize;
+	parameters.thresholdRadius = localThresholdRadius;
+	parameters.dilationRadius = dilationRadius;
+	parameters.colorLevels = colorLevels;
+	filterParameters->SetBufferData(parameters);
+	filterParameters->BindBuffer(FILTER_PARAMETERS_BINDING);
+}
 
-	if (!image || !shader || !shader->program)
-		return;
+int CartoonFilterDemo::GetFirstJumpStep() const
+{
+	// The jumps add up to 2 * step - 1 pixels, so the first step only
+	// has to cover the radius. That takes log2(radius) passes in total
+	int step = 1;
+	while (2 * step <= dilationRadius)
+	{
+		step *= 2;
+	}
+	return dilationRadius > 0 ? step : 0;
+}
 
-	shader->Use();
+void CartoonFilterDemo::FilterOnGpu(Texture2D *image)
+{
+	glm::ivec2 imageSize = glm::ivec2(image->GetWidth(), image->GetHeight());
+	UploadFilterParameters(imageSize);
 
-	// Send resolution
-	int screenSize_loc = shader->GetUniformLocation("screenSize");
-	glm::ivec2 resolution = window->GetResolution();
-	glUniform2i(screenSize_loc, resolution.x, resolution.y);
+	// The edge masks are binary, so a single 8 bit channel is enough
+	FrameBuffer *sobelTarget = renderTargets->Acquire(imageSize, GL_R8);
+	sobelTarget->Bind();
 
-	// Send local threshold radius
-	int threshold_radius_loc = shader->GetUniformLocation("threshold_radius");
-	glUniform1i(threshold_radius_loc, localThresholdRadius);
+	// Apply sobel to determine edges
+	ApplySobelGpu(image);
 
-	// Send image to shader
-	int locTexture = shader->GetUniformLocation("texture_image");
-	glUniform1i(locTexture, 0);
-	image->BindToTextureUnit(GL_TEXTURE0);
+	// Dilate edges
+	FrameBuffer *edgeTarget = DilateImageGpu(sobelTarget);
 
-	RenderMesh(meshes["quad"], shader, glm::mat4(1.0f));
+	resultBuffer->Bind();
 
-	image->UnBind();
+	// Combine outline with the original image to apply the filter
+	ApplyCartoonShader(image, edgeTarget->GetTexture(0));
+	renderTargets->Release(edgeTarget);
+
+	// Targets used for a previous image size are freed
+	renderTargets->Trim();
 }
 
-void CartoonFilterDemo::DilateImageGpu(Texture2D *image)
+void CartoonFilterDemo::RunBatch(const std::vector<std::string> &files, const std::string &outputFolder)
 {
-	Shader *shader = shaders["Dilation"];
-
-	if (!image || !shader || !shader->program)
-		return;
-	
-	shader->Use();
+	InitFilter();
+	InitLayeredFilter();
 
-	// Send resolution
-	int screenSize_loc = shader->GetUniformLocation("screenSize");
-	glm::ivec2 resolution = window->GetResolution();
-	glUniform2i(screenSize_loc, resolution.x, resolution.y);
+	// Decoded image waiting to be uploaded
+	struct DecodedImage
+	{
+		unsigned char *data;
+		int width;
+		int height;
+	};
+
+	// All the layers of an array share the format, so every image is loaded as RGBA
+	auto decode = [](const std::string &file) {
+		DecodedImage image;
+		int channels = 0;
+		image.data = stbi_load(file.c_str(), &image.width, &image.height, &channels, 4);
+		return image;
+	};
+
+	// Name of the input without the folder and the extension
+	auto getName = [](const std::string &file) {
+		size_t start = file.find_last_of("/\\");
+		start = (start == std::string::npos) ? 0 : start + 1;
+		size_t end = file.find_last_of('.');
+		return file.substr(start, (end == std::string::npos || end < start) ? std::string::npos : end - start);
+	};
+
+	unsigned int saved = 0;
+	unsigned int failed = 0;
+	auto onSaved = [&saved, &failed](const std::string &fileName, bool success) {
+		success ? saved++ : failed++;
+		if (!success)
+			std::cout << "Failed to save " << fileName << std::endl;
+	};
+
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	// Images of the same size are filtered together, as many as fit in the
+	// memory budget. Large images end up in batches of a single layer
+	auto getBatchLayers = [maxLayers](const glm::ivec2 &imageSize) {
+		// Input, edges, two jump flood targets and the result
+		size_t layerSize = (size_t)imageSize.x * imageSize.y * (4 + 1 + 4 + 4 + 4);
+		size_t layers = BATCH_MEMORY / std::max(layerSize, (size_t)1);
+		return (unsigned int)std::max((size_t)1, std::min(layers, (size_t)std::min(maxLayers, (GLint)MAX_BATCH_LAYERS)));
+	};
+
+	// Two inputs, so the uploads of the next batch don't have to
+	// wait for the passes that still read from the current one
+	TextureArray inputs[2];
+	LayerTargets targets;
+	int current = 0;
+
+	glm::ivec2 batchSize = glm::ivec2(0);
+	unsigned int batchLayers = 0;
+	std::vector<std::string> batchFiles;
+	unsigned int batches = 0;
+
+	auto flush = [&]() {
+		if (batchFiles.empty())
+			return;
+
+		FilterLayersOnGpu(&inputs[current], static_cast<unsigned int>(batchFiles.size()), targets);
+
+		// The readback is queued after the passes, the results are
+		// encoded on the exporter threads while the next batch runs
+		ImageExporter::SaveLayers(&targets.result, batchFiles, onSaved);
+		ImageExporter::Update();
+
+		// Encoding is usually slower than the GPU, the memory of the
+		// results must not grow with the number of files
+		ImageExporter::WaitForPending(EXPORT_MEMORY);
+
+		batchFiles.clear();
+		current = 1 - current;
+		batches++;
+	};
+
+	double startTime = Engine::GetElapsedTime();
+
+	std::future<DecodedImage> next;
+	if (!files.empty())
+		next = std::async(std::launch::async, decode, files[0]);
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		DecodedImage image = next.get();
 
-	// Send local threshold radius
-	int radius_loc = shader->GetUniformLocation("radius");
-	glUniform1i(radius_loc, dilationRadius);
+		// Decode the next image while this one is uploaded
+		if (i + 1 < files.size())
+			next = std::async(std::launch::async, decode, files[i + 1]);
 
-	// Send image to shader
-	int locTexture = shader->GetUniformLocation("binary_image");
-	glUniform1i(locTexture, 0);
-	image->BindToTextureUnit(GL_TEXTURE0);
+		if (image.data == nullptr)
+		{
+			std::cout << "Could not load " << files[i] << std::endl;
+			failed++;
+			continue;
+		}
 
-	RenderMesh(meshes["quad"], shader, glm::mat4(1.0f));
+		// A different size or a full array starts a new batch
+		glm::ivec2 imageSize = glm::ivec2(image.width, image.height);
+		if (imageSize != batchSize || batchFiles.size() == batchLayers)
+		{
+			flush();
+			batchSize = imageSize;
+			batchLayers = getBatchLayers(imageSize);
+			inputs[current].AllocateStorage(imageSize.x, imageSize.y, batchLayers, GL_RGBA8);
+		}
 
-	image->UnBind();
-}
+		// The upload goes through a pixel buffer and doesn't wait for the GPU
+		inputs[current].UploadLayer(static_cast<unsigned int>(batchFiles.size()), image.data);
+		stbi_image_free(image.data);
 
-void CartoonFilterDemo::ApplyCartoonShader(Texture2D *original, Texture2D *edgeImage)
-{
-	Shader *shader = shaders["Cartoon"];
+		batchFiles.push_back(outputFolder + "/" + getName(files[i]) + ".png");
+	}
+	flush();
 
-	if (!edgeImage || !original || !shader || !shader->program)
-		return;
+	// Waits for the last readbacks and files
+	ImageExporter::Shutdown();
 
-	shader->Use();
+	double elapsedTime = Engine::GetElapsedTime() - startTime;
+	std::cout << "Saved " << saved << " images in " << batches << " batches, " << elapsedTime << "s ("
+		<< (elapsedTime > 0 ? saved / elapsedTime : 0) << " images/s), failed: " << failed << std::endl;
+}
 
-	// Send resolution
-	int screenSize_loc = shader->GetUniformLocation("screenSize");
-	glm::ivec2 resolution = window->GetResolution();
-	glUniform2i(screenSize_loc, resolution.x, resolution.y);
+bool CartoonFilterDemo::RunStrips(const std::string &input, const std::string &output, CpuPipeline::Coloring coloring)
+{
+	CpuPipeline::Parameters parameters = DEFAULT_PARAMETERS;
+	parameters.coloring = coloring;
 
-	// Flip the image coz tex_coords are inversed 
-	int flip_loc = shader->GetUniformLocation("flip");
-	glUniform1i(flip_loc, 1);	
-	
-	// Send color levels 
-	int levels_loc = shader->GetUniformLocation("color_levels");
-	glUniform1i(levels_loc, colorLevels);
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 
-	// Send image to shader
-	int locTexture = shader->GetUniformLocation("texture_image");
-	glUniform1i(locTexture, 0);
-	original->BindToTextureUnit(GL_TEXTURE0);
+	StripFilter filter;
+	if (!filter.Run(input, output, parameters))
+		return false;
 
-	// Send image to shader
-	locTexture = shader->GetUniformLocation("edge_image");
-	glUniform1i(locTexture, 1);
-	edgeImage->BindToTextureUnit(GL_TEXTURE1);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	std::cout << "Saved " << output << " in " << elapsed.count() << "s, "
+		<< filter.GetStripRows() << " rows in each strip" << std::endl;
+	return true;
+}
 
-	RenderMesh(meshes["quad"], shader, glm::mat4(1.0f));
+bool CartoonFilterDemo::RunVideo(const std::string &input, const std::string &output, bool segmentation)
+{
+	// The color levels are the quickest, the segmentation reuses the regions of the last frame
+	CpuPipeline::Parameters parameters = DEFAULT_PARAMETERS;
+	parameters.coloring = segmentation ? Coloring::SEGMENTATION : Coloring::LEVELS;
 
-	edgeImage->UnBind();
-	original->UnBind();
+	VideoFilter filter;
+	return filter.Run(input, output, parameters);
 }
 
-void CartoonFilterDemo::RenderOnCpu()
+bool CartoonFilterDemo::RunResizeBenchmark(const std::string &input)
 {
-	// Process only once
-	if (!processed)
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	unsigned char *data = stbi_load(input.c_str(), &width, &height, &channels, 0);
+	if (data == nullptr)
 	{
-		processed = true;
-
-		// Convert image to grayscale
-		Grayscale(processedImage);
-
-		// Get edges
-		ApplySobelCpu(processedImage);
-
-		// Dilate edges
-		DilateImageCpu(processedImage);
+		std::cout << "Could not load " << input << std::endl;
+		return false;
+	}
 
-		// Add edges over the original image
-		CombineImages(originalImage, processedImage, true);
+	// Best time of a few runs, in milliseconds
+	auto measure = [](int runs, const std::function<void()> &function) {
+		double best = 0;
+		for (int i = 0; i < runs; i++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			function();
+			double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best = (i == 0) ? time : std::min(best, time);
+		}
+		return best;
+	};
 
-		// Segmentation
-		ApplySegmentation(processedImage);
+	const char *filterNames[] = { "box", "bilinear", "lanczos3" };
+	const float scales[] = { 0.5f, 0.3f, 1.7f };
+	for (int filter = Resampler::BOX; filter <= Resampler::LANCZOS3; filter++)
+	{
+		for (float scale : scales)
+		{
+			int targetWidth = std::max(1, static_cast<int>(width * scale));
+			int targetHeight = std::max(1, static_cast<int>(height * scale));
+			std::vector<unsigned char> separable(static_cast<size_t>(targetWidth) * targetHeight * channels);
+			std::vector<unsigned char> naive(separable.size());
+
+			double separableTime = measure(5, [&]() {
+				Resampler::Resize(data, width, height, separable.data(), targetWidth, targetHeight, channels,
+					static_cast<Resampler::Filter>(filter));
+			});
+			double naiveTime = measure(1, [&]() {
+				Resampler::ResizeNaive(data, width, height, naive.data(), targetWidth, targetHeight, channels,
+					static_cast<Resampler::Filter>(filter));
+			});
+
+			int difference = 0;
+			for (size_t i = 0; i < separable.size(); i++)
+				difference = std::max(difference, std::abs(separable[i] - naive[i]));
+
+			std::cout << "Resize " << filterNames[filter] << " " << width << "x" << height << " -> "
+				<< targetWidth << "x" << targetHeight << ": separable " << separableTime << " ms, naive "
+				<< naiveTime << " ms, " << (separableTime > 0 ? naiveTime / separableTime : 0)
+				<< "x faster, largest difference " << difference << std::endl;
+		}
 	}
 
-	RenderImage(processedImage);
+	stbi_image_free(data);
+	return true;
 }
 
-glm::vec3 CartoonFilterDemo::ApplyKernel(Texture2D *image, int posY, int posX, int *kernel, int radius)
+void CartoonFilterDemo::FilterLayersOnGpu(TextureArray *images, unsigned int count, LayerTargets &targets)
 {
-	// Get image data
-	unsigned int channels = image->GetNrChannels();
-	unsigned char *data = image->GetImageData();
+	Shader *sobel = layeredPrograms.sobel->GetVariant({ { "THRESHOLD_RADIUS", localThresholdRadius } });
+	Shader *cartoon = layeredPrograms.cartoon->GetVariant({ { "COLOR_LEVELS", colorLevels } });
+	Shader *seed = layeredPrograms.seed;
+	Shader *flood = layeredPrograms.flood;
+	Shader *outline = layeredPrograms.outline;
 
-	glm::ivec2 imageSize = glm::ivec2(image->GetWidth(), image->GetHeight());
+	if (!sobel->program || !cartoon->program || !seed->program || !flood->program || !outline->program)
+		return;
+
+	glm::ivec2 imageSize = glm::ivec2(images->GetWidth(), images->GetHeight());
+	UploadFilterParameters(imageSize);
 
-	int stride = 2 * radius + 1;
-	glm::vec3 sum = glm::vec3(0.0f);
+	// The targets have as many layers as the input, only the first ones are drawn
+	unsigned int layers = images->GetLayers();
+	targets.edges.AllocateStorage(imageSize.x, imageSize.y, layers, GL_R8);
+	targets.jumpFlood[0].AllocateStorage(imageSize.x, imageSize.y, layers, GL_RG16);
+	targets.jumpFlood[1].AllocateStorage(imageSize.x, imageSize.y, layers, GL_RG16);
+	targets.result.AllocateStorage(imageSize.x, imageSize.y, layers, GL_RGBA8);
 
-	// Apply the kernel centered on the pixel
-	for (int k = -radius; k <= radius; k++)
+	// Apply sobel to determine edges
+	targets.edges.BindAsRenderTarget();
+	sobel->Use();
+	sobel->SetUniform("texture_image", 0);
+	images->BindToTextureUnit(GL_TEXTURE0);
+	quad->RenderInstanced(count);
+
+	// Seed the flood with the edge pixels
+	int current = 0;
+	targets.jumpFlood[current].BindAsRenderTarget();
+	seed->Use();
+	seed->SetUniform("binary_image", 0);
+	targets.edges.BindToTextureUnit(GL_TEXTURE0);
+	quad->RenderInstanced(count);
+
+	for (int step = GetFirstJumpStep(); step > 0; step /= 2)
 	{
-		if (posY + k < 0 || posY + k >= imageSize.y)
-			continue;
+		TextureArray *seeds = &targets.jumpFlood[current];
+		current = 1 - current;
+		targets.jumpFlood[current].BindAsRenderTarget();
+
+		flood->Use();
+		flood->SetUniform("jump_step", step);
+		flood->SetUniform("seed_image", 0);
+		seeds->BindToTextureUnit(GL_TEXTURE0);
+		quad->RenderInstanced(count);
+	}
 
-		for (int l = -radius; l <= radius; l++)
-		{
-			if (posX + l < 0 || posX + l >= imageSize.x)
-				continue;
+	// The edges were consumed by the seed pass, the outline replaces them
+	targets.edges.BindAsRenderTarget();
+	outline->Use();
+	outline->SetUniform("seed_image", 0);
+	targets.jumpFlood[current].BindToTextureUnit(GL_TEXTURE0);
+	quad->RenderInstanced(count);
+
+	// Combine outline with the original images, rows stay in file order
+	targets.result.BindAsRenderTarget();
+	cartoon->Use();
+	cartoon->SetUniform("flip", 0);
+	cartoon->SetUniform("texture_image", 0);
+	images->BindToTextureUnit(GL_TEXTURE0);
+	cartoon->SetUniform("edge_image", 1);
+	targets.edges.BindToTextureUnit(GL_TEXTURE1);
+	quad->RenderInstanced(count);
+
+	targets.edges.UnBind();
+	glActiveTexture(GL_TEXTURE0);
+	images->UnBind();
+	FrameBuffer::BindDefault();
+}
 
-			int offset = channels * ((posY + k) * imageSize.x + (posX + l));
+void CartoonFilterDemo::ApplySobelGpu(Texture2D *image)
+{
+	if (!image || !sobelShader)
+		return;
 
-			// Get kernel coords from top left corner
-			int kernel_i = k + 1;
-			int kernel_j = l + 1;
+	// The radius is compiled into the program used for the current value
+	Shader *shader = sobelShader->GetVariant({ { "THRESHOLD_RADIUS", localThresholdRadius } });
+	if (!shader->program)
+		return;
 
-			glm::vec3 color = glm::vec3(data[offset], data[offset + 1], data[offset + 2]);
+	shader->Use();
 
-			// Use kernel filled with 1s if no kernel is provided
-			if (kernel == nullptr)
-				sum += color;
-			else
-				sum += (float)kernel[kernel_i * stride + kernel_j] * color;
-		}
-	}
+	// Send image to shader, the resolution comes
+	// from the filter parameters block
+	shader->SetUniform("texture_image", 0);
+	image->BindToTextureUnit(GL_TEXTURE0);
+
+	RenderMesh(quad, shader, glm::mat4(1.0f));
 
-	return sum;
+	image->UnBind();
 }
 
-void CartoonFilterDemo::ApplySobelCpu(Texture2D *image)
+FrameBuffer* CartoonFilterDemo::DilateImageGpu(FrameBuffer *edges)
 {
-	if (!image)
-		return;
+	// Without the programs the edges are used as they are
+	if (!seedShader || !floodShader || !outlineShader)
+		return edges;
+
+	if (!seedShader->program || !floodShader->program || !outlineShader->program)
+		return edges;
+
+	// Ping-pong targets holding the closest edge pixel, stored normalized
+	// on 16 bits so that any texture coordinate is represented exactly
+	glm::ivec2 resolution = edges->GetResolution();
+	FrameBuffer *jumpFloodTargets[2] = {
+		renderTargets->Acquire(resolution, GL_RG16),
+		renderTargets->Acquire(resolution, GL_RG16)
+	};
+
+	// Seed the flood with the edge pixels
+	int current = 0;
+	jumpFloodTargets[current]->Bind();
+	{
+		Texture2D *image = edges->GetTexture(0);
 
-	// Sobel Kernels
-	int sobelX[9] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
-	int sobelY[9] = { 1, 2, 1, 0, 0, 0, -1, -2, -1 };
+		seedShader->Use();
 
-	// Get image data
-	unsigned int channels = image->GetNrChannels();
-	unsigned char *data = image->GetImageData();
-	glm::ivec2 imageSize = glm::ivec2(image->GetWidth(), image->GetHeight());
+		seedShader->SetUniform("binary_image", 0);
+		image->BindToTextureUnit(GL_TEXTURE0);
 
-	if (channels < 3)
-		return;
+		RenderMesh(quad, seedShader, glm::mat4(1.0f));
 
-	// Work copy of the image
-	unsigned char *newData = new unsigned char[imageSize.x * imageSize.y * channels];
-	
-	for (int i = 0; i < imageSize.y; i++)
+		image->UnBind();
+	}
+
+	// The edges aren't needed anymore, the outline can be drawn in their target
+	renderTargets->Release(edges);
+
+	for (int step = GetFirstJumpStep(); step > 0; step /= 2)
 	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			// Compute Dx & Dy
-			glm::vec3 sumX = ApplyKernel(image, i, j, sobelX, 1);
-			glm::vec3 sumY = ApplyKernel(image, i, j, sobelY, 1);
+		Texture2D *seeds = jumpFloodTargets[current]->GetTexture(0);
+		current = 1 - current;
+		jumpFloodTargets[current]->Bind();
 
-			// Compute Sobel result
-			glm::vec3 result = abs(sumX) + abs(sumY);
+		floodShader->Use();
 
-			// Compute the average value of the local area
-			// to use as a threshold for binarization
-			glm::vec3 threshold = ApplyKernel(image, i, j, nullptr, localThresholdRadius);
-			threshold /= (2 * localThresholdRadius + 1) * (2 * localThresholdRadius + 1);
+		// Send jump distance
+		floodShader->SetUniform("jump_step", step);
 
-			// Binarize the Sobel result
-			unsigned char value = static_cast<unsigned char>(result.x >= threshold.x ? 255 : 0);
+		// Send closest seeds found so far
+		floodShader->SetUniform("seed_image", 0);
+		seeds->BindToTextureUnit(GL_TEXTURE0);
 
-			// Write new data
-			memset(&newData[channels * (i * imageSize.x + j)], value, 3);
-		}
+		RenderMesh(quad, floodShader, glm::mat4(1.0f));
+
+		seeds->UnBind();
 	}
 
-	// Write back the data in the image
-	for (int i = 0; i < imageSize.y; i++)
+	// Threshold the distance field to get the outline
+	FrameBuffer *outline = renderTargets->Acquire(resolution, GL_R8);
+	outline->Bind();
 	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
-			memcpy(&data[offset], &newData[offset], 3);
-		}
+		Texture2D *seeds = jumpFloodTargets[current]->GetTexture(0);
+
+		outlineShader->Use();
+
+		// Send closest seeds
+		outlineShader->SetUniform("seed_image", 0);
+		seeds->BindToTextureUnit(GL_TEXTURE0);
+
+		RenderMesh(quad, outlineShader, glm::mat4(1.0f));
+
+		seeds->UnBind();
 	}
-	image->UploadNewData(data);
 
-	delete newData;
+	renderTargets->Release(jumpFloodTargets[0]);
+	renderTargets->Release(jumpFloodTargets[1]);
+	return outline;
 }
 
-void CartoonFilterDemo::DilateImageCpu(Texture2D *image)
+void CartoonFilterDemo::ApplyCartoonShader(Texture2D *original, Texture2D *edgeImage)
 {
-	// Get image data
-	unsigned int channels = image->GetNrChannels();
-	unsigned char *data = image->GetImageData();
-	glm::ivec2 imageSize = glm::ivec2(image->GetWidth(), image->GetHeight());
+	if (!edgeImage || !original || !cartoonShader)
+		return;
 
-	if (channels < 3)
+	// The number of levels is compiled into the program used for the current value
+	bool usePalette = (gpuColoring == Coloring::PALETTE);
+	Shader *shader = usePalette ? cartoonShader->GetVariant({ { "PALETTE", 1 } })
+		: cartoonShader->GetVariant({ { "COLOR_LEVELS", colorLevels } });
+	if (!shader->program)
 		return;
 
-	// Work copy of the image
-	unsigned char *newData = new unsigned char[imageSize.x * imageSize.y * channels];
+	shader->Use();
 
-	for (int i = 0; i < imageSize.y; i++)
-	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			// Apply a simple kernel
-			glm::vec3 result = ApplyKernel(image, i, j, nullptr, dilationRadius);
+	// Keep the rows in the order of the image file, the
+	// result is flipped when it's presented on the screen
+	shader->SetUniform("flip", 0);
 
-			// Clamp the result in 0 - 255
-			unsigned char value = static_cast<unsigned char>(result.x > 255 ? 255 : result.x);
+	// Send image to shader
+	shader->SetUniform("texture_image", 0);
+	original->BindToTextureUnit(GL_TEXTURE0);
 
-			// Set the new value
-			memset(&newData[channels * (i * imageSize.x + j)], value, 3);
-		}
-	}
+	// Send image to shader
+	shader->SetUniform("edge_image", 1);
+	edgeImage->BindToTextureUnit(GL_TEXTURE1);
 
-	// Write back the data in the image
-	for (int i = 0; i < imageSize.y; i++)
+	// Send the palette lookup table to shader
+	if (usePalette)
 	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
-			memcpy(&data[offset], &newData[offset], 3);
-		}
+		shader->SetUniform("palette", 2);
+		paletteTexture->BindToTextureUnit(GL_TEXTURE2);
 	}
-	image->UploadNewData(data);
 
-	delete newData;
+	RenderMesh(quad, shader, glm::mat4(1.0f));
+
+	if (usePalette)
+		paletteTexture->UnBind();
+	edgeImage->UnBind();
+	original->UnBind();
 }
 
-void CartoonFilterDemo::CombineImages(Texture2D *image1, Texture2D *image2, bool subtract)
-{	
-	// Get image data
-	unsigned int channels = image1->GetNrChannels();
-	unsigned char *data1 = image1->GetImageData();
-	unsigned char *data2 = image2->GetImageData();
-	glm::ivec2 imageSize = glm::ivec2(image1->GetWidth(), image1->GetHeight());
+CpuPipeline::Parameters CartoonFilterDemo::GetCpuParameters() const
+{
+	CpuPipeline::Parameters parameters;
+	parameters.thresholdRadius = localThresholdRadius;
+	parameters.dilationRadius = dilationRadius;
+	parameters.coloring = cpuColoring;
+	parameters.colorLevels = colorLevels;
+	parameters.paletteColors = paletteColors;
+	return parameters;
+}
 
-	if (channels < 3)
+void CartoonFilterDemo::RenderOnCpu()
+{
+	// Zoomed in, the whole image is filtered once the zoom is reset
+	if (zoom > 1)
+	{
+		RenderTilesOnCpu();
 		return;
+	}
 
-	for (int i = 0; i < imageSize.y; i++)
+	// Filter again when the image or the parameters change
+	if (!processed)
 	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
-			glm::ivec3 color1 = glm::vec3(data1[offset], data1[offset + 1], data1[offset + 2]);
-			glm::ivec3 color2 = glm::vec3(data2[offset], data2[offset + 1], data2[offset + 2]);
+		processed = true;
+		cpuWorker->Request(GetCpuParameters(), std::chrono::milliseconds(CPU_REQUEST_DELAY));
+	}
 
-			// Combine the colors
-			glm::ivec3 resultingPixel;
-			if (subtract)
-			{
-				resultingPixel = color1 - color2; 
-			}
-			else
+	// The last finished result is shown until the next one is ready
+	if (cpuWorker->TakeResult(cpuResult))
+	{
+		if (cpuResult.level == 0)
+		{
+			size_t size = static_cast<size_t>(processedImage->GetWidth()) * processedImage->GetHeight() * processedImage->GetNrChannels();
+			if (cpuResult.data.size() == size)
 			{
-				resultingPixel = color1 + color2;
+				memcpy(processedImage->GetImageData(), cpuResult.data.data(), size);
+				processedImage->UploadNewData(processedImage->GetImageData());
+				cpuShownImage = processedImage;
 			}
-			resultingPixel = glm::clamp(resultingPixel, glm::ivec3(0), glm::ivec3(255));
-
-			// Write back the values in the first image
-			data2[offset] = static_cast<unsigned char>(resultingPixel.x);
-			data2[offset + 1] = static_cast<unsigned char>(resultingPixel.y);
-			data2[offset + 2] = static_cast<unsigned char>(resultingPixel.z);
+		}
+		else
+		{
+			// Previews are scaled to the window like the full image
+			cpuPreview->Create(cpuResult.data.data(), cpuResult.width, cpuResult.height, cpuResult.channels);
+			cpuShownImage = cpuPreview.get();
 		}
 	}
 
-	image2->UploadNewData(data2);
+	RenderImage(cpuShownImage ? cpuShownImage : processedImage, GetViewRect());
 }
 
-void CartoonFilterDemo::ApplySegmentation(Texture2D *image)
+void CartoonFilterDemo::RenderTilesOnCpu()
 {
-	// Get image data
-	unsigned int channels = image->GetNrChannels();
-	unsigned char *data = image->GetImageData();
-	glm::ivec2 imageSize = glm::ivec2(image->GetWidth(), image->GetHeight());
-
-	if (channels < 3)
+	if (!originalImage)
 		return;
 
-	std::vector< std::vector<Region*> > regions;
+	if (tiledFilter->SetParameters(GetCpuParameters()))
+		tileViewChanged = true;
 
-	// Store all the unique regions for later deletion
-	std::vector<Region*> uniqueRegions;
-
-	for (int i = 0; i < imageSize.y; i++)
+	// The image is shown until the worker has built the pyramid
+	glm::vec4 view = GetViewRect();
+	std::shared_ptr<const TiledFilter::Levels> levels = tiledFilter->GetLevels();
+	if (!levels || levels->empty())
 	{
-		regions.push_back(std::vector<Region*>());
-
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			// Get current pixel
-			int offset = channels * (i * imageSize.x + j);
-			glm::vec3 color = glm::vec3(data[offset], data[offset + 1], data[offset + 2]);
+		RenderImage(originalImage, view);
+		return;
+	}
 
-			Region* newRegion = nullptr;
+	// The smallest level with at least one pixel for each pixel of the window
+	glm::ivec2 resolution = window->GetResolution();
+	float levelPixels = view.z * originalImage->GetWidth() / std::max(resolution.x, 1);
+	int level = 0;
+	while (level + 1 < static_cast<int>(levels->size()) && levelPixels >= 2)
+	{
+		levelPixels /= 2;
+		level++;
+	}
 
-			// TopLeft neighbour
-			if (i > 0 && j > 0 && regions[i - 1][j - 1]->CheckIfSimilar(color))
-			{
-				newRegion = regions[i - 1][j - 1];
-			}
+	const ImageBuffer &source = (*levels)[level];
+	int left = static_cast<int>(std::floor(view.x * source.width));
+	int top = static_cast<int>(std::floor(view.y * source.height));
+	int right = static_cast<int>(std::ceil((view.x + view.z) * source.width));
+	int bottom = static_cast<int>(std::ceil((view.y + view.w) * source.height));
 
-			// Top neighbour
-			if (i > 0 && regions[i - 1][j]->CheckIfSimilar(color))
-			{
-				float diff = glm::distance(color, regions[i - 1][j]->GetAvg());
+	// The worker wakes the render loop when more tiles are done
+	if (tiledFilter->Update(level, left, top, right, bottom))
+		tileViewChanged = true;
 
-				// Assign only if distance is less than the previous region
-				if (newRegion == nullptr || glm::distance(color, newRegion->GetAvg()) > diff)
-				{
-					newRegion = regions[i - 1][j];
-				}
-			}
+	// The texture covers the tiles in the view
+	int tileSize = TiledFilter::TILE_SIZE;
+	glm::ivec4 rect = glm::ivec4(left / tileSize * tileSize, top / tileSize * tileSize,
+		std::min((right + tileSize - 1) / tileSize * tileSize, source.width),
+		std::min((bottom + tileSize - 1) / tileSize * tileSize, source.height));
 
-			// Left neighbour
-			if (j > 0 && regions[i][j - 1]->CheckIfSimilar(color))
+	if (rect != tileViewRect || level != tileViewLevel || tileViewChanged)
+	{
+		// Gathered again when the next tiles are done
+		tileViewRect = rect;
+		tileViewLevel = level;
+		tileViewChanged = false;
+
+		// Tiles that aren't filtered yet show the image
+		unsigned int channels = source.channels;
+		int width = rect.z - rect.x;
+		int height = rect.w - rect.y;
+		tileViewData.resize(static_cast<size_t>(width) * height * channels);
+		for (int y = rect.y; y < rect.w; y += tileSize)
+		{
+			for (int x = rect.x; x < rect.z; x += tileSize)
 			{
-				float diff = glm::distance(color, regions[i][j - 1]->GetAvg());
-
-				// Assign only if distance is less than the previous region
-				if (newRegion == nullptr || glm::distance(color, newRegion->GetAvg()) > diff)
+				const TiledFilter::Tile *tile = tiledFilter->FindTile(level, x / tileSize, y / tileSize);
+				int tileWidth = std::min(tileSize, source.width - x);
+				int tileHeight = std::min(tileSize, source.height - y);
+				for (int i = 0; i < tileHeight; i++)
 				{
-					newRegion = regions[i][j - 1];
+					const unsigned char *row = tile ? &tile->image.data[static_cast<size_t>(i) * tileWidth * channels]
+						: &source.data[(static_cast<size_t>(y + i) * source.width + x) * channels];
+					memcpy(&tileViewData[(static_cast<size_t>(y - rect.y + i) * width + x - rect.x) * channels], row, tileWidth * channels);
 				}
 			}
-
-			// Assign the current pixel to a region
-			if (newRegion == nullptr)
-			{
-				regions[i].push_back(new Region());
-				uniqueRegions.push_back(regions[i][j]);
-				regions[i][j]->AddPixel(color);
-			}
-			else
-			{
-				regions[i].push_back(newRegion);
-				regions[i][j]->AddPixel(color);
-			}
 		}
+		tileView->Create(tileViewData.data(), width, height, channels);
 	}
 
-	// Blend the pixels in each region
-	for (int i = 0; i < imageSize.y; i++)
-	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
+	// The view in coordinates of the texture
+	glm::vec2 size = glm::vec2(rect.z - rect.x, rect.w - rect.y);
+	glm::vec2 offset = glm::vec2(view.x * source.width - rect.x, view.y * source.height - rect.y);
+	glm::vec2 scale = glm::vec2(view.z * source.width, view.w * source.height);
+	RenderImage(tileView.get(), glm::vec4(offset / size, scale / size));
+}
 
-			// Get average color
-			glm::vec3 avg = regions[i][j]->GetAvg();
+glm::vec4 CartoonFilterDemo::GetViewRect() const
+{
+	float size = 1 / zoom;
+	return glm::vec4(viewCenter - size / 2, size, size);
+}
 
-			// The new color will be the average of the region
-			data[offset] = static_cast<unsigned char>(avg.x);
-			data[offset + 1] = static_cast<unsigned char>(avg.y);
-			data[offset + 2] = static_cast<unsigned char>(avg.z);
-		}
-	}
+void CartoonFilterDemo::ClampView()
+{
+	float size = 1 / zoom;
+	viewCenter = glm::clamp(viewCenter, glm::vec2(size / 2), glm::vec2(1 - size / 2));
+}
 
-	// Delete regions
-	for (auto r : uniqueRegions)
-	{
-		delete r;
-	}
+void CartoonFilterDemo::ShowCpuProgress()
+{
+	int progress = cpuWorker->IsBusy() ? static_cast<int>(cpuWorker->GetProgress() * 100) : -1;
+	if (progress == shownProgress)
+		return;
 
-	image->UploadNewData(data);
+	shownProgress = progress;
+	if (progress < 0)
+		window->SetTitle(window->props.name);
+	else
+		window->SetTitle(window->props.name + " - CPU filter " + std::to_string(progress) + "%");
 }
 
-void CartoonFilterDemo::Grayscale(Texture2D *image)
+void CartoonFilterDemo::UpdatePalette()
 {
-	// Get image data
-	unsigned int channels = image->GetNrChannels();
-	unsigned char* data = image->GetImageData();
+	if (!paletteChanged || !originalImage)
+		return;
 
-	glm::ivec2 imageSize = glm::ivec2(originalImage->GetWidth(), originalImage->GetHeight());
+	paletteChanged = false;
 
-	if (channels < 3)
-		return;
+	size_t pixelCount = static_cast<size_t>(originalImage->GetWidth()) * originalImage->GetHeight();
+	palette.Build(originalImage->GetImageData(), pixelCount, originalImage->GetNrChannels(), paletteColors);
 
-	for (int i = 0; i < imageSize.y; i++)
+	if (paletteTexture)
 	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
-
-			// Convert color to grayscale value 
-			char value = static_cast<char>(data[offset + 0] * 0.21f + data[offset + 1] * 0.71f + data[offset + 2] * 0.07);
-			memset(&data[offset], value, 3);
-		}
+		int cells = PaletteQuantizer::CELLS;
+		paletteTexture->AllocateStorage(cells, cells, cells, GL_RGBA8);
+		paletteTexture->UploadData(palette.GetLookupTable());
 	}
-	image->UploadNewData(data);
+
+	std::cout << "Palette: " << palette.GetPalette().size() / 3 << " colors" << std::endl;
 }
 
 void CartoonFilterDemo::AdjustWindow()
@@ -579,10 +920,40 @@ void CartoonFilterDemo::AdjustWindow()
 	float aspectRatio = static_cast<float>(originalImage->GetWidth()) / originalImage->GetHeight();
 	window->SetSize(static_cast<int>(windowSize.y * aspectRatio), windowSize.y);
 
-	// Resize frame buffers
-	glm::vec2 resolution = window->GetResolution();
-	sobelBuffer->Resize(resolution.x, resolution.y);
-	edgeBuffer->Resize(resolution.x, resolution.y);
+	// The GPU passes work at the resolution of the image
+	ResizeBuffers(glm::ivec2(originalImage->GetWidth(), originalImage->GetHeight()));
+}
+
+void CartoonFilterDemo::ResizeBuffers(glm::ivec2 resolution)
+{
+	if (resultBuffer->GetResolution() == resolution)
+		return;
+
+	// The intermediate targets are acquired at the size of the image
+	resultBuffer->Resize(resolution.x, resolution.y);
+
+	gpuProcessed = false;
+}
+
+void CartoonFilterDemo::SaveResult()
+{
+	std::cout << "Saving image!" << std::endl;
+
+	// Reported on the render thread once the file is written
+	auto onSaved = [](const std::string &fileName, bool saved) {
+		std::cout << (saved ? "Saved " : "Failed to save ") << fileName << std::endl;
+	};
+
+	// The GPU result is read back from its offscreen target
+	// at the resolution of the image, regardless of the window
+	if (mode == Mode::GPU)
+	{
+		resultBuffer->GetTexture(0)->SaveToFileAsync("cartoon_gpu.png", onSaved);
+	}
+	else if (mode == Mode::CPU)
+	{
+		processedImage->SaveToFileAsync("cartoon_cpu.png", onSaved);
+	}
 }
 
 void CartoonFilterDemo::SelectImage()
@@ -600,30 +971,20 @@ void CartoonFilterDemo::SelectImage()
 	AdjustWindow();
 
 	processed = false;
-}
-
-void CartoonFilterDemo::ResetToOriginal()
-{	
-	// Get image data
-	unsigned int channels = processedImage->GetNrChannels();
-	unsigned char *data = processedImage->GetImageData();
-	unsigned char *originalData = originalImage->GetImageData();
-
-	glm::ivec2 imageSize = glm::ivec2(processedImage->GetWidth(), processedImage->GetHeight());
-
-	if (channels < 3)
-		return;
-	
-	// Write back the data in the image
-	for (int i = 0; i < imageSize.y; i++)
-	{
-		for (int j = 0; j < imageSize.x; j++)
-		{
-			int offset = channels * (i * imageSize.x + j);
-			memcpy(&data[offset], &originalData[offset], 3);
-		}
-	}
-	processedImage->UploadNewData(data);
+	gpuProcessed = false;
+	paletteChanged = true;
+
+	// The CPU filter works on its own copy of the image
+	cpuShownImage = processedImage;
+	cpuWorker->SetImage(originalImage->GetImageData(), originalImage->GetWidth(),
+		originalImage->GetHeight(), originalImage->GetNrChannels());
+
+	// The zoomed view starts over, its tiles are filtered from another copy
+	tiledFilter->SetImage(originalImage->GetImageData(), originalImage->GetWidth(),
+		originalImage->GetHeight(), originalImage->GetNrChannels());
+	tileViewChanged = true;
+	zoom = 1;
+	viewCenter = glm::vec2(0.5f);
 }
 
 void CartoonFilterDemo::OnKeyPress(int key, int mods)
@@ -640,19 +1001,58 @@ void CartoonFilterDemo::OnKeyPress(int key, int mods)
 		SelectImage();
 	}
 
-	// Reload image on CPU
+	// Reload image on CPU, all the stages run again
 	if (key == GLFW_KEY_R && mode == Mode::CPU)
 	{
 		processed = false;
-		ResetToOriginal();
+		cpuWorker->Invalidate();
+		tiledFilter->Invalidate();
+		tileViewChanged = true;
+	}
+
+	// Show the whole image again
+	if (key == GLFW_KEY_Z)
+	{
+		zoom = 1;
+		viewCenter = glm::vec2(0.5f);
+	}
+
+	// Save the filtered image
+	if (key == GLFW_KEY_S && mods & GLFW_MOD_CONTROL)
+	{
+		SaveResult();
+	}
+
+	// Switch between segmentation, color levels, palette and k-means on CPU
+	if (key == GLFW_KEY_Q && mode == Mode::CPU)
+	{
+		cpuColoring = (Coloring)((cpuColoring + 1) % 4);
+		processed = false;
+	}
+
+	// Show the smaller levels first on CPU
+	if (key == GLFW_KEY_V && mode == Mode::CPU)
+	{
+		cpuWorker->SetProgressive(!cpuWorker->IsProgressive());
+		std::cout << "Progressive preview: " << (cpuWorker->IsProgressive() ? "on" : "off") << std::endl;
 	}
 
-	// Can only modify parameters in GPU mode
-	if (mode != Mode::GPU)
+	// Switch between color levels and palette on GPU
+	if (key == GLFW_KEY_Q && mode == Mode::GPU)
+	{
+		gpuColoring = (gpuColoring == Coloring::LEVELS) ? Coloring::PALETTE : Coloring::LEVELS;
+		gpuProcessed = false;
+	}
+
+	// The original image has no parameters
+	if (mode == Mode::SIMPLE)
 	{
 		return;
 	}
 
+	// Any parameter change invalidates the cached results
+	int parameters[4] = { dilationRadius, colorLevels, localThresholdRadius, paletteColors };
+
 	// Outline modifier
 	if (key == GLFW_KEY_P)
 	{
@@ -664,15 +1064,30 @@ void CartoonFilterDemo::OnKeyPress(int key, int mods)
 		dilationRadius = dilationRadius < 0 ? 0 : dilationRadius;
 	}
 
-	// Color levels
-	if (key == GLFW_KEY_M)
+	// Color levels, or the palette size when the palette or k-means is used
+	Coloring coloring = (mode == Mode::GPU) ? gpuColoring : cpuColoring;
+	if (coloring == Coloring::PALETTE || coloring == Coloring::KMEANS)
 	{
-		colorLevels++;
+		if (key == GLFW_KEY_M)
+		{
+			paletteColors = paletteColors < 256 ? paletteColors * 2 : paletteColors;
+		}
+		if (key == GLFW_KEY_N)
+		{
+			paletteColors = paletteColors > 2 ? paletteColors / 2 : paletteColors;
+		}
 	}
-	if (key == GLFW_KEY_N)
+	else
 	{
-		colorLevels--;
-		colorLevels = colorLevels < 0 ? 0 : colorLevels;
+		if (key == GLFW_KEY_M)
+		{
+			colorLevels++;
+		}
+		if (key == GLFW_KEY_N)
+		{
+			colorLevels--;
+			colorLevels = colorLevels < 0 ? 0 : colorLevels;
+		}
 	}
 
 	// Binarization threshold
@@ -685,4 +1100,45 @@ void CartoonFilterDemo::OnKeyPress(int key, int mods)
 		localThresholdRadius--;
 		localThresholdRadius = localThresholdRadius < 0 ? 0 : localThresholdRadius;
 	}
+
+	if (parameters[3] != paletteColors)
+	{
+		paletteChanged = true;
+	}
+
+	if (parameters[0] != dilationRadius || parameters[1] != colorLevels || parameters[2] != localThresholdRadius
+		|| parameters[3] != paletteColors)
+	{
+		// The CPU filter only runs the stages that use the changed parameter
+		gpuProcessed = false;
+		processed = false;
+	}
+}
+
+void CartoonFilterDemo::OnMouseMove(int mouseX, int mouseY, int deltaX, int deltaY)
+{
+	// Drag the image with the left button
+	if (!window->MouseHold(GLFW_MOUSE_BUTTON_LEFT) || zoom <= 1)
+		return;
+
+	glm::ivec2 resolution = window->GetResolution();
+	viewCenter -= glm::vec2(deltaX, deltaY) / glm::vec2(resolution) / zoom;
+	ClampView();
+}
+
+void CartoonFilterDemo::OnMouseScroll(int mouseX, int mouseY, int offsetX, int offsetY)
+{
+	if (!originalImage || !offsetY)
+		return;
+
+	// The point of the image under the cursor stays in place
+	glm::ivec2 resolution = window->GetResolution();
+	glm::vec2 cursor = glm::vec2(mouseX, mouseY) / glm::vec2(resolution);
+	glm::vec4 view = GetViewRect();
+	glm::vec2 point = glm::vec2(view.x, view.y) + cursor * glm::vec2(view.z, view.w);
+
+	float maxZoom = std::max(1.0f, MAX_PIXEL_ZOOM * originalImage->GetWidth() / std::max(resolution.x, 1));
+	zoom = glm::clamp(zoom * std::pow(ZOOM_STEP, static_cast<float>(offsetY)), 1.0f, maxZoom);
+	viewCenter = point - (cursor - 0.5f) / zoom;
+	ClampView();
 }
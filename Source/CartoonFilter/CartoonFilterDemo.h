@@ -3,6 +3,11 @@
 #include <Core/Engine.h>
 #include <Component/SimpleScene.h>
 #include <CartoonFilter\WinAPIFileBrowser.h>
+#include <CartoonFilter\PaletteQuantizer.h>
+#include <CartoonFilter\CpuFilterWorker.h>
+#include <CartoonFilter\TiledFilter.h>
+#include <CartoonFilter\StripFilter.h>
+#include <CartoonFilter\VideoFilter.h>
 
 class CartoonFilterDemo : public SimpleScene
 {
@@ -12,78 +17,214 @@ public:
 
 	virtual void Init() override;
 
+	// Filters the images offscreen and saves the results in the output folder.
+	// Used instead of Init and Run, with a hidden window
+	void RunBatch(const std::vector<std::string> &files, const std::string &outputFolder);
+
+	// Filters a PNM image of any size on the CPU with the coloring, reading and
+	// writing a strip of rows at a time. Runs without the engine
+	static bool RunStrips(const std::string &input, const std::string &output, CpuPipeline::Coloring coloring);
+
+	// Filters a Y4M video on the CPU, from a file or stdin to a file or stdout.
+	// Runs without the engine, so nothing but the video is written on stdout
+	static bool RunVideo(const std::string &input, const std::string &output, bool segmentation);
+
+	// Times the separable resize of the image against the naive loops for each
+	// filter and prints the largest difference between the two. Runs without the engine
+	static bool RunResizeBenchmark(const std::string &input);
+
 private:
 	enum Mode { SIMPLE = 0, GPU = 1, CPU = 2 };
 
+	// Coloring of the filter, segmentation and k-means are only available on CPU
+	typedef CpuPipeline::Coloring Coloring;
+
+	// Delay of the CPU filter after a change in milliseconds, quicker changes are merged
+	static const int CPU_REQUEST_DELAY = 150;
+
+	// Uniform buffer binding of the filter parameters
+	static const GLuint FILTER_PARAMETERS_BINDING = 0;
+
+	// Limits of the batches filtered together in batch mode
+	static const size_t BATCH_MEMORY = 256 * 1024 * 1024;
+	static const int MAX_BATCH_LAYERS = 64;
+
+	// Results read back and waiting to be saved before the next batch waits for them
+	static const size_t EXPORT_MEMORY = 512 * 1024 * 1024;
+
+	// std140 layout of the FilterParameters block in the GPU passes
+	struct FilterParameters
+	{
+		glm::ivec2 imageSize;
+		int thresholdRadius;
+		int dilationRadius;
+		int colorLevels;
+		int padding[3];
+	};
+
+	// Creates the render targets and the programs used by the GPU filter
+	void InitFilter();
+
+	// Creates the programs of the batched passes
+	void InitLayeredFilter();
+
 	void FrameStart() override;
 	void Update(float deltaTimeSeconds) override;
 	void FrameEnd() override;
 
 	// Input controls
 	void OnKeyPress(int key, int mods) override;
+	void OnMouseMove(int mouseX, int mouseY, int deltaX, int deltaY) override;
+	void OnMouseScroll(int mouseX, int mouseY, int offsetX, int offsetY) override;
 
-	// Renders an image on the screen using the basic shader
-	void RenderImage(Texture2D *image);
+	// Renders the part of the image given in texture coordinates,
+	// with the rows in file order, using the basic shader
+	void RenderImage(Texture2D *image, const glm::vec4 &textureRect = glm::vec4(0, 0, 1, 1));
+
+	// Part of the image shown in the window, in texture coordinates
+	// with the rows in file order. The whole image without zoom
+	glm::vec4 GetViewRect() const;
+
+	// Keeps the view inside the image
+	void ClampView();
 
 	// Applies the filter on the current image using 
-	// Color Quantization on the GPU
+	// Color Quantization on the GPU. The passes run at the
+	// resolution of the image and the result is cached
+	// until the input changes
 	void RenderOnGpu();
 
-	// Applies the filter using segmentation on CPU
+	// Runs the GPU passes on the image into the result buffer
+	void FilterOnGpu(Texture2D *image);
+
+	// Targets of the batched passes, one layer for each image
+	struct LayerTargets
+	{
+		TextureArray edges;
+		TextureArray jumpFlood[2];
+		TextureArray result;
+	};
+
+	// Runs the GPU passes on the first layers of the array. Each pass
+	// covers all the images with a single instanced draw
+	void FilterLayersOnGpu(TextureArray *images, unsigned int count, LayerTargets &targets);
+
+	void UploadFilterParameters(const glm::ivec2 &imageSize);
+
+	// First jump of the flood for the dilation radius, 0 if there is no dilation
+	int GetFirstJumpStep() const;
+
+	// Applies the filter using segmentation on CPU. The filter runs on
+	// a worker thread, the last finished result or preview is shown meanwhile
 	void RenderOnCpu();
 
-	// Converts an RGB image to grayscale
-	void Grayscale(Texture2D *image);
+	// Applies the filter on CPU to the visible tiles only, used when zoomed in.
+	// A few tiles are filtered each frame, the image is shown until they are ready
+	void RenderTilesOnCpu();
+
+	CpuPipeline::Parameters GetCpuParameters() const;
 
-	// Applies the given kernel over the image at the 
-	// given positin. If none kernel is given, 
-	// a simple one (filled with 1) will be used
-	glm::vec3 ApplyKernel(Texture2D *image, int posX, int posY, int *kernel, int radius);
+	// Shows the progress of the CPU filter in the window title
+	void ShowCpuProgress();
 
 	// Applies the sobel kernel to obtain the edges in the image
 	void ApplySobelGpu(Texture2D *image);
-	void ApplySobelCpu(Texture2D *image);
-
-	// Dilates the given binary image
-	void DilateImageGpu(Texture2D *image);
-	void DilateImageCpu(Texture2D *image);
 
-	// Adds up the 2 images
-	void CombineImages(Texture2D *image1, Texture2D *image2, bool subtract = false);
+	// Dilates the given binary image. On the GPU a jump flood
+	// computes the distance to the closest edge, which is
+	// then thresholded with the dilation radius. The GPU version
+	// releases the edges target and returns the outline target
+	FrameBuffer* DilateImageGpu(FrameBuffer *edges);
 
 	// Color Quantization of the image
 	void ApplyCartoonShader(Texture2D *original, Texture2D *edgeImage);
 
-	// Segmentation of the image based on color
-	void ApplySegmentation(Texture2D *image);
+	// Builds the palette of the current image if the image or the
+	// number of colors changed, and uploads its lookup table
+	void UpdatePalette();
 
 	// Adjust the window size to match the aspect ratio
 	void AdjustWindow();
 
+	// Resizes the frame buffers to match the image
+	void ResizeBuffers(glm::ivec2 resolution);
+
+	// Saves the filtered image at full resolution
+	void SaveResult();
+
 	// Opens a new file browser window and opens the selected image
 	void SelectImage();
 
-	// Resets the processed image back to the original version
-	void ResetToOriginal();
-
 private:
 	// Default Window Size
 	glm::ivec2 windowSize;
 
 	// Processing options
 	Mode mode;
+	Coloring cpuColoring;
+	Coloring gpuColoring;
 	bool processed;
+	bool gpuProcessed;
 
 	// Filter parameters
 	int localThresholdRadius;
 	int colorLevels;
 	int dilationRadius;
+	int paletteColors;
+
+	// Palette of the GPU filter
+	PaletteQuantizer palette;
+	bool paletteChanged;
+
+	// CPU filter, run on a worker thread
+	std::unique_ptr<CpuFilterWorker> cpuWorker;
+	CpuFilterWorker::Result cpuResult;
+
+	// Smaller result shown until the full one is ready
+	std::unique_ptr<Texture2D> cpuPreview;
+	Texture2D *cpuShownImage;
+	int shownProgress;
+
+	// Tiles of the visible part of the image when zoomed in on CPU,
+	// gathered in one texture. The rectangle is in pixels of the level
+	std::unique_ptr<TiledFilter> tiledFilter;
+	std::unique_ptr<Texture2D> tileView;
+	std::vector<unsigned char> tileViewData;
+	glm::ivec4 tileViewRect;
+	int tileViewLevel;
+	bool tileViewChanged;
+
+	// View of the image, the center is in texture coordinates
+	float zoom;
+	glm::vec2 viewCenter;
 
 	// Image
 	Texture2D *originalImage;
 	Texture2D *processedImage;
 
 	// Frame Buffer
-	std::unique_ptr<FrameBuffer> sobelBuffer;
-	std::unique_ptr<FrameBuffer> edgeBuffer;
+	std::unique_ptr<RenderTargetPool> renderTargets;
+	std::unique_ptr<FrameBuffer> resultBuffer;
+
+	// GPU resources, cached to avoid the lookups on each pass
+	Mesh *quad;
+	Shader *basicShader;
+	Shader *sobelShader;
+	Shader *seedShader;
+	Shader *floodShader;
+	Shader *outlineShader;
+	Shader *cartoonShader;
+	std::unique_ptr<UBO<FilterParameters>> filterParameters;
+	std::unique_ptr<Texture3D> paletteTexture;
+
+	// Programs of the batched passes, only created in batch mode
+	struct LayeredPrograms
+	{
+		Shader *sobel;
+		Shader *seed;
+		Shader *flood;
+		Shader *outline;
+		Shader *cartoon;
+	};
+	LayeredPrograms layeredPrograms;
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "ColorQuantizer.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define QUANTIZER_SSE2
+	#include <emmintrin.h>
+#endif
+
+ColorQuantizer::ColorQuantizer()
+{
+	for (int i = 0; i < 256; i++)
+		identityTable[i] = static_cast<unsigned char>(i);
+
+	levels = -1;
+	SetLevels(0);
+}
+
+void ColorQuantizer::SetLevels(int levels)
+{
+	if (this->levels == levels)
+		return;
+
+	this->levels = levels;
+
+	// The shader works on normalized colors and the render target
+	// rounds the result back to 8 bits. No levels gives black
+	for (int i = 0; i < 256; i++)
+	{
+		float quantized = 0;
+		if (levels > 0)
+			quantized = std::floor(i / 255.0f * levels) / levels;
+
+		levelsTable[i] = static_cast<unsigned char>(std::floor(quantized * 255.0f + 0.5f));
+	}
+}
+
+int ColorQuantizer::GetLevels() const
+{
+	return levels;
+}
+
+void ColorQuantizer::SubtractAndQuantize(const unsigned char *colors, const unsigned char *edges,
+	unsigned char *result, size_t pixelCount, unsigned int channels) const
+{
+	size_t size = pixelCount * channels;
+	bool hasAlpha = (channels == 4);
+
+	// Table used for each byte of a 16 byte block, 16 is a multiple of 4 channels
+	const unsigned char *tables[16];
+	for (int k = 0; k < 16; k++)
+		tables[k] = (hasAlpha && k % 4 == 3) ? identityTable : levelsTable;
+
+	size_t i = 0;
+
+#ifdef QUANTIZER_SSE2
+	// The edges are not subtracted from alpha
+	const __m128i edgeMask = hasAlpha ? _mm_set1_epi32(0x00FFFFFF) : _mm_set1_epi32(-1);
+
+	alignas(16) unsigned char difference[16];
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i color = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+		__m128i edge = _mm_loadu_si128(reinterpret_cast<const __m128i*>(edges + i));
+
+		// Saturated subtraction, same as clamping the shader output
+		_mm_store_si128(reinterpret_cast<__m128i*>(difference), _mm_subs_epu8(color, _mm_and_si128(edge, edgeMask)));
+
+		for (int k = 0; k < 16; k++)
+			result[i + k] = tables[k][difference[k]];
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		if (hasAlpha && i % 4 == 3)
+		{
+			result[i] = colors[i];
+			continue;
+		}
+
+		int difference = colors[i] - edges[i];
+		result[i] = levelsTable[difference > 0 ? difference : 0];
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+// Uniform color quantization on the CPU, the same as in Cartoon.FS.glsl:
+// each channel is mapped to floor(c * levels) / levels through a lookup
+// table. The table is rebuilt only when the number of levels changes
+class ColorQuantizer
+{
+public:
+	ColorQuantizer();
+
+public:
+	void SetLevels(int levels);
+	int GetLevels() const;
+
+	// Subtracts the edge mask from the colors and quantizes the result,
+	// which can be the edges buffer. Alpha is kept from the colors
+	void SubtractAndQuantize(const unsigned char *colors, const unsigned char *edges,
+		unsigned char *result, size_t pixelCount, unsigned int channels) const;
+
+private:
+	int levels;
+
+	// Quantized value of each byte, the identity table is used for alpha
+	unsigned char levelsTable[256];
+	unsigned char identityTable[256];
+};
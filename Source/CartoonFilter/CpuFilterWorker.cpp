@@ -0,0 +1,221 @@
+#include "CpuFilterWorker.h"
+
+#include <cmath>
+
+#include <include/gl.h>
+
+namespace
+{
+	// Smaller levels are not worth a preview
+	const size_t MIN_PREVIEW_PIXELS = 128 * 128;
+}
+
+CpuFilterWorker::CpuFilterWorker()
+{
+	stop = false;
+	pending = false;
+	invalidate = false;
+	progressive = true;
+	hasResult = false;
+	levelCount = 0;
+	generation = 0;
+	running = false;
+	progress = 0;
+	result.width = 0;
+	result.height = 0;
+	result.channels = 0;
+	result.level = 0;
+
+	thread = std::thread(&CpuFilterWorker::Run, this);
+}
+
+CpuFilterWorker::~CpuFilterWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		generation++;
+	}
+	wake.notify_one();
+	thread.join();
+}
+
+void CpuFilterWorker::SetImage(const unsigned char *data, int width, int height, unsigned int channels)
+{
+	std::shared_ptr<ImageBuffer> copy = std::make_shared<ImageBuffer>();
+	copy->data.assign(data, data + static_cast<size_t>(width) * height * channels);
+	copy->width = width;
+	copy->height = height;
+	copy->channels = channels;
+
+	// Results of the previous image are dropped
+	std::lock_guard<std::mutex> lock(mutex);
+	image = copy;
+	hasResult = false;
+	generation++;
+}
+
+void CpuFilterWorker::Request(const CpuPipeline::Parameters &parameters, std::chrono::milliseconds delay)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// The first change starts at once, the next ones are delayed
+		this->parameters = parameters;
+		startTime = std::chrono::steady_clock::now() + ((pending || running) ? delay : std::chrono::milliseconds(0));
+		pending = true;
+		generation++;
+	}
+	wake.notify_one();
+}
+
+void CpuFilterWorker::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	invalidate = true;
+}
+
+void CpuFilterWorker::SetProgressive(bool progressive)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->progressive = progressive;
+}
+
+bool CpuFilterWorker::IsProgressive() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return progressive;
+}
+
+bool CpuFilterWorker::TakeResult(Result &result)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!hasResult)
+		return false;
+
+	result.data.swap(this->result.data);
+	result.width = this->result.width;
+	result.height = this->result.height;
+	result.channels = this->result.channels;
+	result.level = this->result.level;
+	hasResult = false;
+	return true;
+}
+
+bool CpuFilterWorker::IsBusy() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending || running;
+}
+
+float CpuFilterWorker::GetProgress() const
+{
+	return progress;
+}
+
+void CpuFilterWorker::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (!stop)
+	{
+		if (!pending)
+		{
+			wake.wait(lock);
+			continue;
+		}
+
+		// Each new request moves the start time, so wait until it stops changing
+		if (std::chrono::steady_clock::now() < startTime)
+		{
+			wake.wait_until(lock, startTime);
+			continue;
+		}
+
+		pending = false;
+		running = true;
+		progress = 0;
+		unsigned int runGeneration = generation;
+		CpuPipeline::Parameters runParameters = parameters;
+		std::shared_ptr<const ImageBuffer> runImage = image;
+		bool runInvalidate = invalidate;
+		bool runProgressive = progressive;
+		invalidate = false;
+		lock.unlock();
+
+		if (runImage && (runImage != levelsSource || runInvalidate))
+		{
+			BuildLevels(runImage);
+			for (int level = 0; level <= levelCount; level++)
+			{
+				const ImageBuffer &source = level ? levels[level - 1] : *runImage;
+				pipelines[level].SetImage(source.data.data(), source.width, source.height, source.channels);
+				pipelines[level].Invalidate();
+			}
+		}
+
+		// The progress of each level is weighted by its size
+		int firstLevel = (runImage && runProgressive) ? levelCount : 0;
+		float totalPixels = 0;
+		for (int level = firstLevel; level >= 0; level--)
+			totalPixels += std::ldexp(1.0f, -2 * level);
+
+		float donePixels = 0;
+		int lastPercent = 0;
+		for (int level = firstLevel; runImage && level >= 0; level--)
+		{
+			const ImageBuffer &source = level ? levels[level - 1] : *runImage;
+			float levelPixels = std::ldexp(1.0f, -2 * level);
+
+			// Checked between the rows of each stage
+			std::vector<unsigned char> output;
+			bool completed = pipelines[level].Run(CpuPipeline::ScaleParameters(runParameters, level), output,
+				[&](float value) {
+				progress = (donePixels + value * levelPixels) / totalPixels;
+
+				// Wake the render thread to show the progress
+				bool current = (generation == runGeneration);
+				int percent = static_cast<int>(progress * 100);
+				if (current && percent != lastPercent)
+				{
+					lastPercent = percent;
+					glfwPostEmptyEvent();
+				}
+				return current;
+			});
+			donePixels += levelPixels;
+
+			if (!completed)
+				break;
+
+			// Each level replaces the previous result
+			lock.lock();
+			if (generation == runGeneration)
+			{
+				result.data.swap(output);
+				result.width = source.width;
+				result.height = source.height;
+				result.channels = source.channels;
+				result.level = level;
+				hasResult = true;
+			}
+			lock.unlock();
+
+			if (level)
+				glfwPostEmptyEvent();
+		}
+
+		lock.lock();
+		running = false;
+		progress = 1;
+
+		// The render loop can be waiting for events
+		if (!stop)
+			glfwPostEmptyEvent();
+	}
+}
+
+void CpuFilterWorker::BuildLevels(const std::shared_ptr<const ImageBuffer> &image)
+{
+	levelsSource = image;
+	levelCount = Resampler::BuildPyramid(*image, levels, PREVIEW_LEVELS, MIN_PREVIEW_PIXELS);
+}
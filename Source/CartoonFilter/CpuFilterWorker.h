@@ -0,0 +1,97 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <CartoonFilter\CpuPipeline.h>
+#include <CartoonFilter\Resampler.h>
+
+// Runs the CPU filter on a worker thread. A new request cancels the one
+// in progress, which stops at the next row. While a request is running,
+// new ones wait for a short delay so only the last of several quick
+// changes runs. The render thread takes the finished results with TakeResult.
+// In progressive mode the filter first runs on the 1/8, 1/4 and 1/2 scale
+// levels of the image, and each level is a result shown until the next one
+class CpuFilterWorker
+{
+public:
+	// Levels below the full image, each half the size of the previous one
+	static const int PREVIEW_LEVELS = 3;
+
+	// Filtered image, level 0 is the full resolution
+	struct Result
+	{
+		std::vector<unsigned char> data;
+		int width;
+		int height;
+		unsigned int channels;
+		int level;
+	};
+
+public:
+	CpuFilterWorker();
+	~CpuFilterWorker();
+
+public:
+	// Copies the image used by the next requests, cancels the filter in progress
+	void SetImage(const unsigned char *data, int width, int height, unsigned int channels);
+
+	// Filters the image with the parameters. Cancels the filter in progress
+	// and starts after the delay if there was one, unless another request comes first
+	void Request(const CpuPipeline::Parameters &parameters, std::chrono::milliseconds delay);
+
+	// Discards the cached stages before the next request runs
+	void Invalidate();
+
+	// Shows the smaller levels first, on by default
+	void SetProgressive(bool progressive);
+	bool IsProgressive() const;
+
+	// Swaps the last finished result in, returns false if there is none
+	bool TakeResult(Result &result);
+
+	// True while a request is waiting or running
+	bool IsBusy() const;
+
+	// Progress of the running request between 0 and 1
+	float GetProgress() const;
+
+private:
+	void Run();
+
+	// Builds the smaller levels of the image with a 2x2 box filter
+	void BuildLevels(const std::shared_ptr<const ImageBuffer> &image);
+
+private:
+	std::thread thread;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool stop;
+
+	// Next request, replaced by each call of Request
+	bool pending;
+	bool invalidate;
+	bool progressive;
+	CpuPipeline::Parameters parameters;
+	std::chrono::steady_clock::time_point startTime;
+	std::shared_ptr<const ImageBuffer> image;
+
+	// Increased by each request, the running filter stops when it changes
+	std::atomic<unsigned int> generation;
+	std::atomic<bool> running;
+	std::atomic<float> progress;
+
+	// Only used on the worker thread, each level keeps its own stages
+	std::shared_ptr<const ImageBuffer> levelsSource;
+	ImageBuffer levels[PREVIEW_LEVELS];
+	CpuPipeline pipelines[PREVIEW_LEVELS + 1];
+	int levelCount;
+
+	bool hasResult;
+	Result result;
+};
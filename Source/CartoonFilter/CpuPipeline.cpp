@@ -0,0 +1,586 @@
+#include "CpuPipeline.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	// Grayscale, gradient, threshold, dilation and coloring
+	const int STAGE_COUNT = 5;
+
+	// A pixel of the temporal segmentation changed if any channel moved more
+	// than the threshold, so the noise of a still shot doesn't count. A block
+	// with more than a quarter of its pixels changed is grown again, in the
+	// others only the changed pixels are, such as the edges that come and go.
+	// Past the largest share of changed blocks, e.g. after a cut, all of it is
+	// grown again
+	const int BLOCK_SIZE = 16;
+	const int MOTION_THRESHOLD = 12;
+	const int MAX_BLOCK_CHANGES = BLOCK_SIZE * BLOCK_SIZE / 4;
+	const float MAX_CHANGED_SHARE = 0.5f;
+
+	// A seeded region keeps its color until its average moves this far away
+	const float COLOR_TOLERANCE = 6.0f;
+
+	const int NO_REGION = -1;
+}
+
+CpuPipeline::CpuPipeline()
+{
+	image = nullptr;
+	gray = nullptr;
+	width = 0;
+	height = 0;
+	channels = 0;
+	stagesRun = 0;
+	stage = 0;
+	cancelled = false;
+	temporal = false;
+	seededRegions = 0;
+	Invalidate();
+}
+
+void CpuPipeline::SetImage(const unsigned char *data, int width, int height, unsigned int channels)
+{
+	if (image == data && this->width == width && this->height == height && this->channels == channels)
+		return;
+
+	image = data;
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	Invalidate();
+}
+
+void CpuPipeline::Invalidate()
+{
+	grayscaleValid = false;
+	gradientValid = false;
+	thresholdRadius = -1;
+	dilationRadius = -1;
+	paletteColors = -1;
+}
+
+void CpuPipeline::SetTemporal(bool temporal)
+{
+	this->temporal = temporal;
+	segmented.clear();
+}
+
+int CpuPipeline::GetStagesRun() const
+{
+	return stagesRun;
+}
+
+CpuPipeline::Parameters CpuPipeline::ScaleParameters(const Parameters &parameters, int level)
+{
+	Parameters scaled = parameters;
+	scaled.thresholdRadius = (parameters.thresholdRadius + (1 << level) / 2) >> level;
+	scaled.dilationRadius = (parameters.dilationRadius + (1 << level) / 2) >> level;
+	return scaled;
+}
+
+void CpuPipeline::BeginStage(int stage)
+{
+	this->stage = stage;
+	stagesRun++;
+}
+
+bool CpuPipeline::ReportProgress(float stageProgress)
+{
+	if (!progress)
+		return true;
+
+	if (!cancelled)
+		cancelled = !progress((stage + stageProgress) / STAGE_COUNT);
+	return !cancelled;
+}
+
+bool CpuPipeline::Run(const Parameters &parameters, std::vector<unsigned char> &result, const ProgressCallback &progress)
+{
+	this->progress = progress;
+	cancelled = false;
+
+	// The colors are needed for the result
+	if (channels < 3)
+	{
+		this->progress = nullptr;
+		return false;
+	}
+
+	const std::vector<unsigned char> &mask = ComputeEdges(parameters.thresholdRadius, parameters.dilationRadius);
+	if (mask.empty())
+	{
+		this->progress = nullptr;
+		return false;
+	}
+
+	BeginStage(4);
+	result.resize(static_cast<size_t>(width) * height * channels);
+
+	// The edges go in the color channels, alpha is kept from the image
+	for (size_t i = 0; i < mask.size(); i++)
+	{
+		memset(&result[channels * i], mask[i], 3);
+		if (channels == 4)
+			result[channels * i + 3] = image[channels * i + 3];
+	}
+
+	bool completed = false;
+	switch (parameters.coloring)
+	{
+	case Coloring::LEVELS:
+	case Coloring::PALETTE:
+		completed = ApplyColorTable(parameters, result.data());
+		break;
+	case Coloring::KMEANS:
+		// Starts from the centroids of the previous image
+		completed = SubtractEdges(result.data()) && kmeans.Apply(result.data(), mask.size(), channels,
+			parameters.paletteColors, [this](float iterations) { return ReportProgress(0.1f + 0.9f * iterations); });
+
+		// The centroid of the black edges can be another color
+		for (size_t i = 0; completed && i < mask.size(); i++)
+		{
+			if (mask[i])
+				memset(&result[channels * i], 0, 3);
+		}
+		break;
+	default:
+		completed = SubtractEdges(result.data()) && ApplySegmentation(result.data());
+		break;
+	}
+
+	this->progress = nullptr;
+	return completed;
+}
+
+const std::vector<unsigned char>& CpuPipeline::GetEdges(int thresholdRadius, int dilationRadius, const ProgressCallback &progress)
+{
+	this->progress = progress;
+	cancelled = false;
+
+	const std::vector<unsigned char> &mask = ComputeEdges(thresholdRadius, dilationRadius);
+	this->progress = nullptr;
+	return mask;
+}
+
+const std::vector<unsigned char>& CpuPipeline::ComputeEdges(int thresholdRadius, int dilationRadius)
+{
+	stagesRun = 0;
+	if (!image || (channels != 1 && channels < 3) || width <= 0 || height <= 0)
+	{
+		dilatedEdges.clear();
+		return dilatedEdges;
+	}
+
+	// Each stage runs if its parameter or any earlier stage changed. The
+	// later stages are discarded first, in case the run is cancelled
+	bool completed = true;
+	if (!grayscaleValid)
+	{
+		gradientValid = false;
+		completed = ComputeGrayscale();
+	}
+	if (completed && !gradientValid)
+	{
+		this->thresholdRadius = -1;
+		completed = ComputeGradient();
+	}
+	if (completed && this->thresholdRadius != thresholdRadius)
+	{
+		this->dilationRadius = -1;
+		completed = ComputeThreshold(thresholdRadius);
+	}
+	if (completed && this->dilationRadius != dilationRadius)
+	{
+		completed = ComputeDilation(dilationRadius);
+	}
+
+	if (!completed)
+	{
+		this->dilationRadius = -1;
+		dilatedEdges.clear();
+	}
+
+	return dilatedEdges;
+}
+
+template <typename T, typename S>
+void CpuPipeline::BuildIntegral(const S *values, std::vector<T> &integral) const
+{
+	int stride = width + 1;
+	integral.assign(static_cast<size_t>(stride) * (height + 1), 0);
+
+	for (int i = 0; i < height; i++)
+	{
+		T rowSum = 0;
+		for (int j = 0; j < width; j++)
+		{
+			rowSum += values[static_cast<size_t>(i) * width + j];
+			integral[static_cast<size_t>(i + 1) * stride + j + 1] = integral[static_cast<size_t>(i) * stride + j + 1] + rowSum;
+		}
+	}
+}
+
+template <typename T>
+T CpuPipeline::WindowSum(const std::vector<T> &integral, int x, int y, int radius) const
+{
+	int stride = width + 1;
+	size_t left = std::max(x - radius, 0);
+	size_t right = std::min(x + radius + 1, width);
+	size_t top = std::max(y - radius, 0);
+	size_t bottom = std::min(y + radius + 1, height);
+
+	return integral[bottom * stride + right] - integral[top * stride + right]
+		- integral[bottom * stride + left] + integral[top * stride + left];
+}
+
+bool CpuPipeline::ComputeGrayscale()
+{
+	BeginStage(0);
+
+	// A single channel is already the grayscale
+	if (channels == 1)
+	{
+		gray = image;
+	}
+	else
+	{
+		grayscale.resize(static_cast<size_t>(width) * height);
+		gray = grayscale.data();
+
+		for (int i = 0; i < height; i++)
+		{
+			if (!ReportProgress(static_cast<float>(i) / height))
+				return false;
+
+			for (size_t j = static_cast<size_t>(i) * width; j < static_cast<size_t>(i + 1) * width; j++)
+			{
+				const unsigned char *pixel = image + j * channels;
+				grayscale[j] = static_cast<unsigned char>(static_cast<int>(pixel[0] * 0.21f + pixel[1] * 0.71f + pixel[2] * 0.07));
+			}
+		}
+	}
+
+	// Used for the mean of the threshold window
+	BuildIntegral(gray, grayscaleIntegral);
+	grayscaleValid = true;
+	return true;
+}
+
+bool CpuPipeline::ComputeGradient()
+{
+	BeginStage(1);
+	gradient.resize(static_cast<size_t>(width) * height);
+
+	// Pixels outside the image are left out of the kernels
+	auto sample = [this](int x, int y) {
+		if (x < 0 || y < 0 || x >= width || y >= height)
+			return 0;
+		return static_cast<int>(gray[static_cast<size_t>(y) * width + x]);
+	};
+
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(static_cast<float>(i) / height))
+			return false;
+
+		for (int j = 0; j < width; j++)
+		{
+			int topLeft = sample(j - 1, i - 1), top = sample(j, i - 1), topRight = sample(j + 1, i - 1);
+			int left = sample(j - 1, i), right = sample(j + 1, i);
+			int bottomLeft = sample(j - 1, i + 1), bottom = sample(j, i + 1), bottomRight = sample(j + 1, i + 1);
+
+			// Sobel kernels
+			int dx = (topRight + 2 * right + bottomRight) - (topLeft + 2 * left + bottomLeft);
+			int dy = (topLeft + 2 * top + topRight) - (bottomLeft + 2 * bottom + bottomRight);
+
+			gradient[static_cast<size_t>(i) * width + j] = std::abs(dx) + std::abs(dy);
+		}
+	}
+
+	gradientValid = true;
+	return true;
+}
+
+bool CpuPipeline::ComputeThreshold(int radius)
+{
+	BeginStage(2);
+	edges.resize(static_cast<size_t>(width) * height);
+
+	// The average of the local area is the threshold for binarization,
+	// the window is divided by its full size even at the borders
+	unsigned long long area = static_cast<unsigned long long>(2 * radius + 1) * (2 * radius + 1);
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(static_cast<float>(i) / height))
+			return false;
+
+		for (int j = 0; j < width; j++)
+		{
+			size_t index = static_cast<size_t>(i) * width + j;
+			unsigned long long sum = WindowSum(grayscaleIntegral, j, i, radius);
+			edges[index] = (gradient[index] * area >= sum) ? 255 : 0;
+		}
+	}
+
+	// Used to find the edges in the dilation window
+	BuildIntegral(edges.data(), edgesIntegral);
+	thresholdRadius = radius;
+	return true;
+}
+
+bool CpuPipeline::ComputeDilation(int radius)
+{
+	BeginStage(3);
+	dilatedEdges.resize(edges.size());
+
+	// A pixel is on the outline if there is any edge in its window
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(static_cast<float>(i) / height))
+			return false;
+
+		for (int j = 0; j < width; j++)
+		{
+			dilatedEdges[static_cast<size_t>(i) * width + j] = WindowSum(edgesIntegral, j, i, radius) ? 255 : 0;
+		}
+	}
+
+	dilationRadius = radius;
+	return true;
+}
+
+bool CpuPipeline::ApplyColorTable(const Parameters &parameters, unsigned char *result)
+{
+	if (parameters.coloring == Coloring::PALETTE && paletteColors != parameters.paletteColors)
+	{
+		palette.Build(image, static_cast<size_t>(width) * height, channels, parameters.paletteColors);
+		paletteColors = parameters.paletteColors;
+	}
+
+	// The tables are rebuilt only if the levels changed
+	quantizer.SetLevels(parameters.colorLevels);
+
+	// Edges and color levels in one pass, one row at a time
+	size_t rowSize = static_cast<size_t>(width) * channels;
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(static_cast<float>(i) / height))
+			return false;
+
+		const unsigned char *colors = image + i * rowSize;
+		unsigned char *row = result + i * rowSize;
+		if (parameters.coloring == Coloring::PALETTE)
+			palette.SubtractAndMap(colors, row, row, width, channels);
+		else
+			quantizer.SubtractAndQuantize(colors, row, row, width, channels);
+	}
+
+	return true;
+}
+
+bool CpuPipeline::SubtractEdges(unsigned char *result)
+{
+	// Subtract the edges to make them black
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(0.1f * i / height))
+			return false;
+
+		for (size_t j = static_cast<size_t>(i) * width; j < static_cast<size_t>(i + 1) * width; j++)
+		{
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				int difference = image[j * channels + k] - result[j * channels + k];
+				result[j * channels + k] = static_cast<unsigned char>(difference > 0 ? difference : 0);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool CpuPipeline::ApplySegmentation(unsigned char *data)
+{
+	size_t pixelCount = static_cast<size_t>(width) * height;
+
+	// Only the changed blocks are grown again if the last image was close enough
+	if (temporal && FindChangedBlocks(data) <= MAX_CHANGED_SHARE)
+	{
+		SeedRegions(data);
+	}
+	else
+	{
+		labels.assign(pixelCount, NO_REGION);
+		regions.clear();
+		regionColors.clear();
+		seededRegions = 0;
+	}
+
+	if (!GrowRegions(data))
+	{
+		segmented.clear();
+		return false;
+	}
+
+	// The next image is compared with the colors before blending
+	if (temporal)
+	{
+		segmented.resize(pixelCount * 3);
+		for (size_t i = 0; i < pixelCount; i++)
+			memcpy(&segmented[i * 3], &data[i * channels], 3);
+	}
+
+	// A seeded region keeps its last color unless its pixels moved away from it
+	regionColors.resize(regions.size() * 3);
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		glm::vec3 avg = regions[i].GetAvg();
+		unsigned char *color = &regionColors[i * 3];
+		if (static_cast<int>(i) < seededRegions && glm::distance(avg, glm::vec3(color[0], color[1], color[2])) < COLOR_TOLERANCE)
+			continue;
+
+		color[0] = static_cast<unsigned char>(avg.x);
+		color[1] = static_cast<unsigned char>(avg.y);
+		color[2] = static_cast<unsigned char>(avg.z);
+	}
+
+	// The new color will be the average of the region
+	for (size_t i = 0; i < pixelCount; i++)
+		memcpy(&data[i * channels], &regionColors[labels[i] * 3], 3);
+
+	return true;
+}
+
+float CpuPipeline::FindChangedBlocks(const unsigned char *data)
+{
+	size_t pixelCount = static_cast<size_t>(width) * height;
+	if (segmented.size() != pixelCount * 3 || labels.size() != pixelCount)
+		return 1.0f;
+
+	int blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int blocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	changedBlocks.assign(static_cast<size_t>(blocksX) * blocksY, 0);
+
+	// Changed pixels are counted up to one past the limit
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			unsigned char &block = changedBlocks[static_cast<size_t>(i / BLOCK_SIZE) * blocksX + j / BLOCK_SIZE];
+			if (block <= MAX_BLOCK_CHANGES && HasChanged(data, static_cast<size_t>(i) * width + j))
+				block++;
+		}
+	}
+
+	int changed = 0;
+	for (unsigned char &block : changedBlocks)
+	{
+		block = (block > MAX_BLOCK_CHANGES) ? 1 : 0;
+		changed += block;
+	}
+
+	return static_cast<float>(changed) / changedBlocks.size();
+}
+
+bool CpuPipeline::HasChanged(const unsigned char *data, size_t index) const
+{
+	for (int k = 0; k < 3; k++)
+	{
+		if (std::abs(data[index * channels + k] - segmented[index * 3 + k]) > MOTION_THRESHOLD)
+			return true;
+	}
+	return false;
+}
+
+void CpuPipeline::SeedRegions(const unsigned char *data)
+{
+	int blocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	// Regions left without pixels are dropped
+	std::vector<int> seeds(regions.size(), NO_REGION);
+	std::vector<Region> kept;
+	std::vector<unsigned char> keptColors;
+
+	for (int i = 0; i < height; i++)
+	{
+		for (int j = 0; j < width; j++)
+		{
+			size_t index = static_cast<size_t>(i) * width + j;
+			if (changedBlocks[static_cast<size_t>(i / BLOCK_SIZE) * blocksX + j / BLOCK_SIZE] || HasChanged(data, index))
+			{
+				labels[index] = NO_REGION;
+				continue;
+			}
+
+			int &seed = seeds[labels[index]];
+			if (seed == NO_REGION)
+			{
+				seed = static_cast<int>(kept.size());
+				kept.push_back(Region());
+				keptColors.insert(keptColors.end(), &regionColors[labels[index] * 3], &regionColors[labels[index] * 3] + 3);
+			}
+
+			labels[index] = seed;
+			const unsigned char *pixel = data + index * channels;
+			kept[seed].AddPixel(glm::vec3(pixel[0], pixel[1], pixel[2]));
+		}
+	}
+
+	regions.swap(kept);
+	regionColors.swap(keptColors);
+	this->seededRegions = static_cast<int>(regions.size());
+}
+
+bool CpuPipeline::GrowRegions(const unsigned char *data)
+{
+	for (int i = 0; i < height; i++)
+	{
+		if (!ReportProgress(0.1f + 0.8f * i / height))
+			return false;
+
+		for (int j = 0; j < width; j++)
+		{
+			size_t index = static_cast<size_t>(i) * width + j;
+			if (labels[index] != NO_REGION)
+				continue;
+
+			// Get current pixel
+			const unsigned char *pixel = data + index * channels;
+			glm::vec3 color = glm::vec3(pixel[0], pixel[1], pixel[2]);
+
+			// Assign only if distance is less than the previous region
+			int label = NO_REGION;
+			auto join = [&](size_t neighbour) {
+				Region &region = regions[labels[neighbour]];
+				if (region.CheckIfSimilar(color) &&
+					(label == NO_REGION || glm::distance(color, regions[label].GetAvg()) > glm::distance(color, region.GetAvg())))
+				{
+					label = labels[neighbour];
+				}
+			};
+
+			// TopLeft, top and left neighbours
+			if (i > 0 && j > 0)
+				join(index - width - 1);
+			if (i > 0)
+				join(index - width);
+			if (j > 0)
+				join(index - 1);
+
+			// Assign the current pixel to a region
+			if (label == NO_REGION)
+			{
+				label = static_cast<int>(regions.size());
+				regions.push_back(Region());
+			}
+
+			labels[index] = label;
+			regions[label].AddPixel(color);
+		}
+	}
+
+	return true;
+}
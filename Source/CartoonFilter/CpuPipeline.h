@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+#include <CartoonFilter\ColorQuantizer.h>
+#include <CartoonFilter\PaletteQuantizer.h>
+#include <CartoonFilter\KMeansQuantizer.h>
+#include <CartoonFilter\Region.h>
+
+// Stages of the CPU filter. The output of each edge detection stage is kept
+// together with the parameters it was computed with, so a parameter change
+// only runs the stages that depend on it:
+//   grayscale -> sobel magnitude -> local threshold -> dilation -> coloring
+// The stages report their progress between rows and stop when asked to
+class CpuPipeline
+{
+public:
+	// Coloring of the filter, segmentation and k-means are only available on CPU
+	enum Coloring { SEGMENTATION = 0, LEVELS = 1, PALETTE = 2, KMEANS = 3 };
+
+	struct Parameters
+	{
+		int thresholdRadius;
+		int dilationRadius;
+		Coloring coloring;
+		int colorLevels;
+		int paletteColors;
+	};
+
+	// Receives the progress of the run between 0 and 1, returns false to cancel it
+	typedef std::function<bool(float)> ProgressCallback;
+
+public:
+	CpuPipeline();
+
+public:
+	// Sets the input of the first stage. A different image discards all the stages.
+	// A single channel image, such as the luma plane of a video frame, is used as
+	// the grayscale directly. Only its edges can be computed, it can't be colored
+	void SetImage(const unsigned char *data, int width, int height, unsigned int channels);
+
+	// Discards all the stages, used when the image data is replaced in place.
+	// The k-means centroids are kept, the next image starts from them
+	void Invalidate();
+
+	// Keeps the segmentation of the last image and grows the regions again only
+	// in the blocks that changed, for the frames of a video. The regions of the
+	// other blocks are seeded from the last labels, so they keep their colors
+	void SetTemporal(bool temporal);
+
+	// Filters the image into the result, with the same channels as the input.
+	// Returns false if the run was cancelled, the finished stages are kept
+	bool Run(const Parameters &parameters, std::vector<unsigned char> &result, const ProgressCallback &progress = nullptr);
+
+	// Returns the dilated edge mask, one byte for each pixel, 255 on the edges.
+	// The mask is empty if the run was cancelled
+	const std::vector<unsigned char>& GetEdges(int thresholdRadius, int dilationRadius, const ProgressCallback &progress = nullptr);
+
+	// Number of stages run by the last call
+	int GetStagesRun() const;
+
+	// Parameters for a level of the image pyramid, radii are measured in pixels of the level
+	static Parameters ScaleParameters(const Parameters &parameters, int level);
+
+private:
+	// Runs the edge stages that are out of date, reporting to the current callback
+	const std::vector<unsigned char>& ComputeEdges(int thresholdRadius, int dilationRadius);
+
+	bool ComputeGrayscale();
+	bool ComputeGradient();
+	bool ComputeThreshold(int radius);
+	bool ComputeDilation(int radius);
+
+	// Coloring of the result, which holds the edges on input
+	bool ApplyColorTable(const Parameters &parameters, unsigned char *result);
+	bool SubtractEdges(unsigned char *result);
+	bool ApplySegmentation(unsigned char *data);
+
+	// Marks the blocks of the segmentation input that changed since the last
+	// image, returns their share or 1 if there is nothing to compare with
+	float FindChangedBlocks(const unsigned char *data);
+	bool HasChanged(const unsigned char *data, size_t index) const;
+
+	// Keeps the labels of the unchanged pixels in the unchanged blocks, their regions
+	// are rebuilt from those pixels only and numbered again from 0
+	void SeedRegions(const unsigned char *data);
+
+	// Assigns the pixels without a label to a similar neighbouring region or to a new one
+	bool GrowRegions(const unsigned char *data);
+
+	// Reports the progress of the current stage, returns false to stop it
+	bool ReportProgress(float stageProgress);
+	void BeginStage(int stage);
+
+	// Sum of the values in the window clipped to the image
+	template <typename T>
+	T WindowSum(const std::vector<T> &integral, int x, int y, int radius) const;
+
+	// Summed area table with an extra row and column of zeros
+	template <typename T, typename S>
+	void BuildIntegral(const S *values, std::vector<T> &integral) const;
+
+private:
+	const unsigned char *image;
+	int width;
+	int height;
+	unsigned int channels;
+	int stagesRun;
+
+	ProgressCallback progress;
+	int stage;
+	bool cancelled;
+
+	// Stage outputs, a negative parameter marks a stage that has to run
+	bool grayscaleValid;
+	bool gradientValid;
+	int thresholdRadius;
+	int dilationRadius;
+	int paletteColors;
+
+	// Input of the edge stages, the image itself if it has a single channel
+	const unsigned char *gray;
+	std::vector<unsigned char> grayscale;
+	std::vector<unsigned long long> grayscaleIntegral;
+	std::vector<int> gradient;
+	std::vector<unsigned char> edges;
+	std::vector<unsigned long long> edgesIntegral;
+	std::vector<unsigned char> dilatedEdges;
+
+	// Lookup tables and centroids of the coloring
+	ColorQuantizer quantizer;
+	PaletteQuantizer palette;
+	KMeansQuantizer kmeans;
+
+	// Region of each pixel and the colors the regions were drawn with.
+	// In temporal mode the input of the last segmentation is kept as well
+	bool temporal;
+	std::vector<int> labels;
+	std::vector<Region> regions;
+	std::vector<unsigned char> regionColors;
+	int seededRegions;
+	std::vector<unsigned char> segmented;
+	std::vector<unsigned char> changedBlocks;
+};
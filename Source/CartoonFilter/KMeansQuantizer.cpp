@@ -0,0 +1,257 @@
+#include "KMeansQuantizer.h"
+
+#include <cmath>
+#include <future>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+namespace
+{
+	const int MAX_ITERATIONS = 30;
+
+	// Centroids moving less than this are considered converged
+	const float CONVERGENCE_DISTANCE = 0.5f;
+
+	// Pixels handled by a thread, smaller images use fewer threads
+	const size_t MIN_PIXELS_PER_THREAD = 1 << 16;
+}
+
+KMeansQuantizer::KMeansQuantizer()
+{
+	iterations = 0;
+	warmStart = false;
+	largestMovement = 0;
+	secondMovement = 0;
+	largestIndex = -1;
+}
+
+void KMeansQuantizer::Reset()
+{
+	warmStart = false;
+}
+
+int KMeansQuantizer::GetIterations() const
+{
+	return iterations;
+}
+
+std::vector<unsigned char> KMeansQuantizer::GetPalette() const
+{
+	std::vector<unsigned char> palette;
+	palette.reserve(centroids.size() * 3);
+	for (const Centroid &centroid : centroids)
+	{
+		for (int k = 0; k < 3; k++)
+			palette.push_back(static_cast<unsigned char>(centroid.color[k] + 0.5f));
+	}
+	return palette;
+}
+
+float KMeansQuantizer::Distance(const float *a, const float *b)
+{
+	float dr = a[0] - b[0];
+	float dg = a[1] - b[1];
+	float db = a[2] - b[2];
+	return std::sqrt(dr * dr + dg * dg + db * db);
+}
+
+void KMeansQuantizer::InitCentroids(const unsigned char *data, size_t pixelCount, unsigned int channels, int clusterCount)
+{
+	// The last centroids are a good guess for a similar image
+	if (warmStart && centroids.size() == static_cast<size_t>(clusterCount))
+		return;
+
+	seeds.Build(data, pixelCount, channels, clusterCount);
+	const std::vector<unsigned char> &palette = seeds.GetPalette();
+
+	centroids.resize(palette.size() / 3);
+	for (size_t j = 0; j < centroids.size(); j++)
+	{
+		for (int k = 0; k < 3; k++)
+			centroids[j].color[k] = palette[j * 3 + k];
+	}
+}
+
+size_t KMeansQuantizer::AssignRange(const unsigned char *data, unsigned int channels, size_t begin, size_t end,
+	bool initial, std::vector<PartialSum> &sums)
+{
+	size_t changes = 0;
+	size_t clusterCount = centroids.size();
+
+	for (size_t i = begin; i < end; i++)
+	{
+		const unsigned char *pixel = data + i * channels;
+		float color[3] = { static_cast<float>(pixel[0]), static_cast<float>(pixel[1]), static_cast<float>(pixel[2]) };
+		int current = assignment[i];
+
+		if (!initial)
+		{
+			// Keep the bounds valid for the centroids moved in the last iteration
+			upperBound[i] += movement[current];
+			lowerBound[i] -= (current == largestIndex) ? secondMovement : largestMovement;
+
+			// The centroid can't change if the pixel is closer to it than
+			// half the distance to its neighbours or than any other centroid
+			float bound = std::max(separation[current], lowerBound[i]);
+			if (upperBound[i] > bound)
+			{
+				upperBound[i] = Distance(color, centroids[current].color);
+				if (upperBound[i] > bound)
+					current = -1;
+			}
+		}
+		else
+		{
+			current = -1;
+		}
+
+		if (current < 0)
+		{
+			// Full search for the closest and the second closest centroid
+			float nearest = INFINITY;
+			float second = INFINITY;
+			int nearestIndex = 0;
+			for (size_t j = 0; j < clusterCount; j++)
+			{
+				float distance = Distance(color, centroids[j].color);
+				if (distance < nearest)
+				{
+					second = nearest;
+					nearest = distance;
+					nearestIndex = static_cast<int>(j);
+				}
+				else if (distance < second)
+				{
+					second = distance;
+				}
+			}
+
+			if (nearestIndex != assignment[i])
+				changes++;
+
+			assignment[i] = nearestIndex;
+			upperBound[i] = nearest;
+			lowerBound[i] = second;
+			current = nearestIndex;
+		}
+
+		PartialSum &sum = sums[current];
+		sum.color[0] += color[0];
+		sum.color[1] += color[1];
+		sum.color[2] += color[2];
+		sum.count++;
+	}
+
+	return changes;
+}
+
+bool KMeansQuantizer::Apply(unsigned char *data, size_t pixelCount, unsigned int channels, int clusterCount,
+	const std::function<bool(float)> &progress)
+{
+	iterations = 0;
+	if (!data || !pixelCount || channels < 3 || clusterCount < 1)
+		return true;
+
+	InitCentroids(data, pixelCount, channels, clusterCount);
+
+	size_t clusters = centroids.size();
+	if (!clusters)
+		return true;
+
+	assignment.assign(pixelCount, -1);
+	upperBound.resize(pixelCount);
+	lowerBound.resize(pixelCount);
+	separation.resize(clusters);
+
+	size_t threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+	threadCount = std::max<size_t>(1, std::min(threadCount, pixelCount / MIN_PIXELS_PER_THREAD));
+	size_t chunk = (pixelCount + threadCount - 1) / threadCount;
+
+	std::vector<std::vector<PartialSum>> partialSums(threadCount);
+	std::vector<std::future<size_t>> tasks(threadCount);
+	movement.assign(clusters, 0);
+
+	for (iterations = 1; iterations <= MAX_ITERATIONS; iterations++)
+	{
+		for (size_t j = 0; j < clusters; j++)
+		{
+			float closest = INFINITY;
+			for (size_t other = 0; other < clusters; other++)
+			{
+				if (other != j)
+					closest = std::min(closest, Distance(centroids[j].color, centroids[other].color));
+			}
+			separation[j] = closest / 2;
+		}
+
+		// Each thread sums its own pixels, the sums are merged afterwards
+		bool initial = (iterations == 1);
+		for (size_t t = 0; t < threadCount; t++)
+		{
+			partialSums[t].assign(clusters, PartialSum());
+			size_t begin = std::min(pixelCount, t * chunk);
+			size_t end = std::min(pixelCount, begin + chunk);
+			tasks[t] = std::async(std::launch::async, &KMeansQuantizer::AssignRange, this,
+				data, channels, begin, end, initial, std::ref(partialSums[t]));
+		}
+
+		size_t changes = 0;
+		for (auto &task : tasks)
+			changes += task.get();
+
+		// Move the centroids to the mean of their pixels
+		largestMovement = 0;
+		secondMovement = 0;
+		largestIndex = -1;
+		for (size_t j = 0; j < clusters; j++)
+		{
+			PartialSum total = PartialSum();
+			for (size_t t = 0; t < threadCount; t++)
+			{
+				for (int k = 0; k < 3; k++)
+					total.color[k] += partialSums[t][j].color[k];
+				total.count += partialSums[t][j].count;
+			}
+
+			// Empty clusters keep their place
+			float previous[3] = { centroids[j].color[0], centroids[j].color[1], centroids[j].color[2] };
+			if (total.count)
+			{
+				for (int k = 0; k < 3; k++)
+					centroids[j].color[k] = static_cast<float>(total.color[k] / total.count);
+			}
+
+			movement[j] = Distance(previous, centroids[j].color);
+			if (movement[j] > largestMovement)
+			{
+				secondMovement = largestMovement;
+				largestMovement = movement[j];
+				largestIndex = static_cast<int>(j);
+			}
+			else if (movement[j] > secondMovement)
+			{
+				secondMovement = movement[j];
+			}
+		}
+
+		if ((!initial && !changes) || largestMovement < CONVERGENCE_DISTANCE)
+			break;
+
+		if (progress && !progress(static_cast<float>(iterations) / MAX_ITERATIONS))
+			return false;
+	}
+	iterations = std::min(iterations, MAX_ITERATIONS);
+
+	// The last assignment may be one step behind the centroids, close enough
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		const Centroid &centroid = centroids[assignment[i]];
+		unsigned char *pixel = data + i * channels;
+		for (int k = 0; k < 3; k++)
+			pixel[k] = static_cast<unsigned char>(centroid.color[k] + 0.5f);
+	}
+
+	warmStart = true;
+	return true;
+}
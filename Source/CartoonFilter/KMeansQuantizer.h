@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+#include <CartoonFilter\PaletteQuantizer.h>
+
+// Color reduction with k-means, run on all the cores. Each pixel keeps an
+// upper bound of the distance to its centroid and a lower bound of the
+// distance to any other centroid (Hamerly), so most pixels skip the
+// distance computations once the centroids settle. The centroids of the
+// previous run are used as the starting point of the next one
+class KMeansQuantizer
+{
+public:
+	KMeansQuantizer();
+
+public:
+	// Replaces the colors of the image with the closest centroid. Alpha is kept.
+	// The progress is reported after each iteration and can stop the run, in
+	// which case the image is not changed and false is returned
+	bool Apply(unsigned char *data, size_t pixelCount, unsigned int channels, int clusterCount,
+		const std::function<bool(float)> &progress = nullptr);
+
+	// The next run starts from a median cut palette instead of the last centroids
+	void Reset();
+
+	int GetIterations() const;
+
+	// RGB colors of the centroids found by the last run, rounded like the pixels
+	std::vector<unsigned char> GetPalette() const;
+
+private:
+	struct Centroid
+	{
+		float color[3];
+	};
+
+	// Sums of the colors assigned to a centroid by one thread
+	struct PartialSum
+	{
+		double color[3];
+		size_t count;
+	};
+
+	void InitCentroids(const unsigned char *data, size_t pixelCount, unsigned int channels, int clusterCount);
+
+	// Assigns the pixels in the range and adds them to the partial sums.
+	// Returns the number of pixels that changed centroid
+	size_t AssignRange(const unsigned char *data, unsigned int channels, size_t begin, size_t end,
+		bool initial, std::vector<PartialSum> &sums);
+
+	static float Distance(const float *a, const float *b);
+
+private:
+	int iterations;
+	bool warmStart;
+
+	std::vector<Centroid> centroids;
+
+	// Half of the distance from each centroid to the closest other centroid
+	std::vector<float> separation;
+
+	// Distance moved by each centroid in the last iteration
+	std::vector<float> movement;
+	float largestMovement;
+	float secondMovement;
+	int largestIndex;
+
+	// State of each pixel
+	std::vector<int> assignment;
+	std::vector<float> upperBound;
+	std::vector<float> lowerBound;
+
+	PaletteQuantizer seeds;
+};
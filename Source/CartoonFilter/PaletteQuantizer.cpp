@@ -0,0 +1,266 @@
+#include "PaletteQuantizer.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Limit of the pixels added to the histogram
+	const size_t MAX_SAMPLES = 1 << 18;
+	const int CELL_SHIFT = 8 - PaletteQuantizer::CELL_BITS;
+}
+
+PaletteQuantizer::PaletteQuantizer()
+{
+	histogram.resize(CELLS * CELLS * CELLS);
+	lookupTable.resize(histogram.size() * 4, 0);
+}
+
+int PaletteQuantizer::GetCellIndex(int red, int green, int blue)
+{
+	return (blue * CELLS + green) * CELLS + red;
+}
+
+void PaletteQuantizer::Build(const unsigned char *data, size_t pixelCount, unsigned int channels, int colorCount)
+{
+	palette.clear();
+	std::fill(histogram.begin(), histogram.end(), 0);
+
+	if (!data || !pixelCount || channels < 3 || colorCount < 1)
+	{
+		BuildLookupTable();
+		return;
+	}
+
+	// Evenly spaced samples are enough to find the dominant colors
+	size_t step = std::max<size_t>(1, pixelCount / MAX_SAMPLES);
+	for (size_t i = 0; i < pixelCount; i += step)
+	{
+		const unsigned char *pixel = data + i * channels;
+		histogram[GetCellIndex(pixel[0] >> CELL_SHIFT, pixel[1] >> CELL_SHIFT, pixel[2] >> CELL_SHIFT)]++;
+	}
+
+	std::vector<Box> boxes(1);
+	for (int k = 0; k < 3; k++)
+	{
+		boxes[0].min[k] = 0;
+		boxes[0].max[k] = CELLS - 1;
+	}
+	FitBox(boxes[0]);
+
+	// Split the most populated boxes, weighted by their size, until
+	// there are enough colors or every box is a single cell
+	while (boxes.size() < static_cast<size_t>(colorCount))
+	{
+		int selected = -1;
+		unsigned long long bestScore = 0;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			int longest = 0;
+			for (int k = 0; k < 3; k++)
+				longest = std::max(longest, boxes[i].max[k] - boxes[i].min[k]);
+
+			unsigned long long score = boxes[i].population * longest;
+			if (score > bestScore)
+			{
+				bestScore = score;
+				selected = static_cast<int>(i);
+			}
+		}
+
+		Box other;
+		if (selected < 0 || !SplitBox(boxes[selected], other))
+			break;
+		boxes.push_back(other);
+	}
+
+	// Each color is the average of the samples in its box
+	for (const Box &box : boxes)
+	{
+		if (!box.population)
+			continue;
+
+		unsigned long long sum[3] = { 0, 0, 0 };
+		for (int b = box.min[2]; b <= box.max[2]; b++)
+			for (int g = box.min[1]; g <= box.max[1]; g++)
+				for (int r = box.min[0]; r <= box.max[0]; r++)
+				{
+					unsigned long long count = histogram[GetCellIndex(r, g, b)];
+					sum[0] += count * r;
+					sum[1] += count * g;
+					sum[2] += count * b;
+				}
+
+		// Samples lie anywhere in their cell, so use the cell center
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned long long value = ((sum[k] << CELL_SHIFT) + box.population * (1 << CELL_SHIFT) / 2) / box.population;
+			palette.push_back(static_cast<unsigned char>(std::min<unsigned long long>(value, 255)));
+		}
+	}
+
+	BuildLookupTable();
+}
+
+void PaletteQuantizer::SetPalette(const std::vector<unsigned char> &colors)
+{
+	palette.assign(colors.begin(), colors.begin() + colors.size() / 3 * 3);
+	BuildLookupTable();
+}
+
+void PaletteQuantizer::FitBox(Box &box) const
+{
+	int min[3] = { CELLS, CELLS, CELLS };
+	int max[3] = { -1, -1, -1 };
+	box.population = 0;
+
+	for (int b = box.min[2]; b <= box.max[2]; b++)
+		for (int g = box.min[1]; g <= box.max[1]; g++)
+			for (int r = box.min[0]; r <= box.max[0]; r++)
+			{
+				unsigned int count = histogram[GetCellIndex(r, g, b)];
+				if (!count)
+					continue;
+
+				int cell[3] = { r, g, b };
+				for (int k = 0; k < 3; k++)
+				{
+					min[k] = std::min(min[k], cell[k]);
+					max[k] = std::max(max[k], cell[k]);
+				}
+				box.population += count;
+			}
+
+	if (!box.population)
+		return;
+
+	for (int k = 0; k < 3; k++)
+	{
+		box.min[k] = min[k];
+		box.max[k] = max[k];
+	}
+}
+
+bool PaletteQuantizer::SplitBox(Box &box, Box &other) const
+{
+	int axis = 0;
+	for (int k = 1; k < 3; k++)
+	{
+		if (box.max[k] - box.min[k] > box.max[axis] - box.min[axis])
+			axis = k;
+	}
+
+	if (box.max[axis] == box.min[axis])
+		return false;
+
+	// Samples in each slice of the box along the axis
+	std::vector<unsigned long long> slices(box.max[axis] - box.min[axis] + 1, 0);
+	for (int b = box.min[2]; b <= box.max[2]; b++)
+		for (int g = box.min[1]; g <= box.max[1]; g++)
+			for (int r = box.min[0]; r <= box.max[0]; r++)
+			{
+				int cell[3] = { r, g, b };
+				slices[cell[axis] - box.min[axis]] += histogram[GetCellIndex(r, g, b)];
+			}
+
+	// The first slice past half of the samples starts the second box,
+	// the fitted box has samples at both ends so neither half is empty
+	int median = box.min[axis];
+	unsigned long long count = 0;
+	while (median < box.max[axis] && (count + slices[median - box.min[axis]]) * 2 <= box.population)
+	{
+		count += slices[median - box.min[axis]];
+		median++;
+	}
+	if (median == box.min[axis])
+		median++;
+
+	other = box;
+	box.max[axis] = median - 1;
+	other.min[axis] = median;
+
+	FitBox(box);
+	FitBox(other);
+	return true;
+}
+
+void PaletteQuantizer::BuildLookupTable()
+{
+	size_t colorCount = palette.size() / 3;
+
+	for (int b = 0; b < CELLS; b++)
+		for (int g = 0; g < CELLS; g++)
+			for (int r = 0; r < CELLS; r++)
+			{
+				int center[3] = {
+					(r << CELL_SHIFT) + (1 << CELL_SHIFT) / 2,
+					(g << CELL_SHIFT) + (1 << CELL_SHIFT) / 2,
+					(b << CELL_SHIFT) + (1 << CELL_SHIFT) / 2 };
+
+				// Nearest palette color to the center of the cell, black without a palette
+				size_t nearest = 0;
+				int nearestDistance = -1;
+				for (size_t i = 0; i < colorCount; i++)
+				{
+					int distance = 0;
+					for (int k = 0; k < 3; k++)
+					{
+						int delta = center[k] - palette[i * 3 + k];
+						distance += delta * delta;
+					}
+
+					if (nearestDistance < 0 || distance < nearestDistance)
+					{
+						nearestDistance = distance;
+						nearest = i;
+					}
+				}
+
+				unsigned char *entry = &lookupTable[GetCellIndex(r, g, b) * 4];
+				for (int k = 0; k < 3; k++)
+					entry[k] = colorCount ? palette[nearest * 3 + k] : 0;
+				entry[3] = 255;
+			}
+}
+
+void PaletteQuantizer::SubtractAndMap(const unsigned char *colors, const unsigned char *edges,
+	unsigned char *result, size_t pixelCount, unsigned int channels) const
+{
+	if (channels < 3)
+		return;
+
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		size_t offset = i * channels;
+		if (channels == 4)
+			result[offset + 3] = colors[offset + 3];
+
+		// The palette color nearest to black can be bright, the edges stay black
+		if (edges[offset] && edges[offset + 1] && edges[offset + 2])
+		{
+			result[offset] = result[offset + 1] = result[offset + 2] = 0;
+			continue;
+		}
+
+		int cell[3];
+		for (int k = 0; k < 3; k++)
+		{
+			int difference = colors[offset + k] - edges[offset + k];
+			cell[k] = (difference > 0 ? difference : 0) >> CELL_SHIFT;
+		}
+
+		const unsigned char *entry = &lookupTable[GetCellIndex(cell[0], cell[1], cell[2]) * 4];
+		result[offset] = entry[0];
+		result[offset + 1] = entry[1];
+		result[offset + 2] = entry[2];
+	}
+}
+
+const unsigned char* PaletteQuantizer::GetLookupTable() const
+{
+	return lookupTable.data();
+}
+
+const std::vector<unsigned char>& PaletteQuantizer::GetPalette() const
+{
+	return palette;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Adaptive color quantization. The palette is built with median cut over
+// a histogram of the image, then the nearest palette color of every cell
+// of a 32x32x32 grid is stored in a lookup table, so mapping a pixel
+// takes a single table load. The table is also uploaded as a 3D texture
+class PaletteQuantizer
+{
+public:
+	// Bits of each channel used to index the table
+	static const int CELL_BITS = 5;
+	static const int CELLS = 1 << CELL_BITS;
+
+public:
+	PaletteQuantizer();
+
+public:
+	// Builds a palette of at most the given number of colors
+	void Build(const unsigned char *data, size_t pixelCount, unsigned int channels, int colorCount);
+
+	// Uses the given RGB colors as the palette, such as the k-means centroids
+	void SetPalette(const std::vector<unsigned char> &colors);
+
+	// Subtracts the edge mask from the colors and maps the result to the
+	// palette, pixels on the edges are black. The result can be the edges
+	// buffer. Alpha is kept from the colors
+	void SubtractAndMap(const unsigned char *colors, const unsigned char *edges,
+		unsigned char *result, size_t pixelCount, unsigned int channels) const;
+
+	// RGBA palette color of each cell, red varies fastest
+	const unsigned char* GetLookupTable() const;
+	const std::vector<unsigned char>& GetPalette() const;
+
+private:
+	// Box of histogram cells, bounds are inclusive
+	struct Box
+	{
+		int min[3];
+		int max[3];
+		unsigned long long population;
+	};
+
+	static int GetCellIndex(int red, int green, int blue);
+
+	// Shrinks the box to the cells that have samples and counts them
+	void FitBox(Box &box) const;
+
+	// Splits the box at the median of its longest side
+	bool SplitBox(Box &box, Box &other) const;
+
+	void BuildLookupTable();
+
+private:
+	std::vector<unsigned int> histogram;
+	std::vector<unsigned char> palette;
+	std::vector<unsigned char> lookupTable;
+};
@@ -0,0 +1,191 @@
+#include "PnmFile.h"
+
+#include <cctype>
+#include <cstdlib>
+
+PnmReader::PnmReader()
+{
+	width = 0;
+	height = 0;
+	channels = 0;
+	rowsRead = 0;
+}
+
+std::string PnmReader::ReadToken()
+{
+	std::string token;
+	int c = file.get();
+	while (c != EOF)
+	{
+		if (c == '#')
+		{
+			while (c != EOF && c != '\n')
+				c = file.get();
+		}
+		else if (std::isspace(c))
+		{
+			if (!token.empty())
+				break;
+		}
+		else
+		{
+			token.push_back(static_cast<char>(c));
+		}
+		c = file.get();
+	}
+	return token;
+}
+
+bool PnmReader::ReadPamHeader()
+{
+	int maxValue = 0;
+	for (std::string token = ReadToken(); token != "ENDHDR"; token = ReadToken())
+	{
+		if (token.empty())
+			return false;
+
+		if (token == "WIDTH")
+			width = std::atoi(ReadToken().c_str());
+		else if (token == "HEIGHT")
+			height = std::atoi(ReadToken().c_str());
+		else if (token == "DEPTH")
+			channels = std::atoi(ReadToken().c_str());
+		else if (token == "MAXVAL")
+			maxValue = std::atoi(ReadToken().c_str());
+		else if (token == "TUPLTYPE")
+			ReadToken();
+	}
+
+	return maxValue == 255 && (channels == 3 || channels == 4);
+}
+
+bool PnmReader::Open(const std::string &fileName)
+{
+	file.close();
+	file.clear();
+	file.open(fileName.c_str(), std::ios::in | std::ios::binary);
+	width = 0;
+	height = 0;
+	channels = 0;
+	rowsRead = 0;
+	if (!file.is_open())
+		return false;
+
+	std::string magic = ReadToken();
+	bool valid = false;
+	if (magic == "P6")
+	{
+		width = std::atoi(ReadToken().c_str());
+		height = std::atoi(ReadToken().c_str());
+		channels = 3;
+
+		// A single whitespace separates the max value from the pixels
+		valid = (std::atoi(ReadToken().c_str()) == 255);
+	}
+	else if (magic == "P7")
+	{
+		valid = ReadPamHeader();
+	}
+
+	if (!valid || width <= 0 || height <= 0)
+	{
+		file.close();
+		return false;
+	}
+
+	dataStart = file.tellg();
+	return true;
+}
+
+bool PnmReader::ReadRows(unsigned char *data, int rowCount)
+{
+	if (!file.is_open() || rowCount < 0 || rowsRead + rowCount > height)
+		return false;
+
+	std::streamsize size = static_cast<std::streamsize>(width) * channels * rowCount;
+	file.read(reinterpret_cast<char*>(data), size);
+	rowsRead += rowCount;
+	return file.gcount() == size;
+}
+
+bool PnmReader::Rewind()
+{
+	if (!file.is_open())
+		return false;
+
+	file.clear();
+	file.seekg(dataStart);
+	rowsRead = 0;
+	return file.good();
+}
+
+int PnmReader::GetWidth() const
+{
+	return width;
+}
+
+int PnmReader::GetHeight() const
+{
+	return height;
+}
+
+unsigned int PnmReader::GetChannels() const
+{
+	return channels;
+}
+
+PnmWriter::PnmWriter()
+{
+	width = 0;
+	height = 0;
+	channels = 0;
+	rowsWritten = 0;
+}
+
+bool PnmWriter::Open(const std::string &fileName, int width, int height, unsigned int channels)
+{
+	if (channels != 3 && channels != 4)
+		return false;
+
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	rowsWritten = 0;
+
+	file.close();
+	file.clear();
+	file.open(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	if (channels == 3)
+	{
+		file << "P6\n" << width << " " << height << "\n255\n";
+	}
+	else
+	{
+		file << "P7\nWIDTH " << width << "\nHEIGHT " << height
+			<< "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+	}
+	return file.good();
+}
+
+bool PnmWriter::WriteRows(const unsigned char *data, int rowCount)
+{
+	if (!file.is_open() || rowCount < 0 || rowsWritten + rowCount > height)
+		return false;
+
+	file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(width) * channels * rowCount);
+	rowsWritten += rowCount;
+	return file.good();
+}
+
+bool PnmWriter::Close()
+{
+	if (!file.is_open())
+		return false;
+
+	bool complete = file.good() && rowsWritten == height;
+	file.close();
+	return complete && !file.fail();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+
+// Binary PNM images read and written a few rows at a time, so an image
+// never has to fit in memory. P6 holds RGB pixels and P7 (PAM) holds RGB
+// or RGBA pixels, both with 8 bits per channel
+class PnmReader
+{
+public:
+	PnmReader();
+
+public:
+	// Reads the header, returns false if the file isn't a supported PNM
+	bool Open(const std::string &fileName);
+
+	// Reads the next rows in file order, returns false past the end of the image
+	bool ReadRows(unsigned char *data, int rowCount);
+
+	// Goes back to the first row
+	bool Rewind();
+
+	int GetWidth() const;
+	int GetHeight() const;
+	unsigned int GetChannels() const;
+
+private:
+	// Next token of the header, comments are skipped
+	std::string ReadToken();
+
+	bool ReadPamHeader();
+
+private:
+	std::ifstream file;
+	std::streampos dataStart;
+	int width;
+	int height;
+	unsigned int channels;
+	int rowsRead;
+};
+
+class PnmWriter
+{
+public:
+	PnmWriter();
+
+public:
+	// Writes the header, P6 for 3 channels and P7 for 4
+	bool Open(const std::string &fileName, int width, int height, unsigned int channels);
+
+	// Appends the rows, returns false if the file can't be written
+	bool WriteRows(const unsigned char *data, int rowCount);
+
+	// Returns true if all the rows were written
+	bool Close();
+
+private:
+	std::ofstream file;
+	int width;
+	int height;
+	unsigned int channels;
+	int rowsWritten;
+};
@@ -0,0 +1,351 @@
+#include "Resampler.h"
+
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define RESAMPLER_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+
+	// Rows handled by a thread, smaller images use fewer threads
+	const int MIN_ROWS_PER_THREAD = 64;
+
+	float Sinc(float x)
+	{
+		if (x == 0)
+			return 1;
+		x *= PI;
+		return std::sin(x) / x;
+	}
+
+	unsigned char ToByte(float value)
+	{
+		value = value < 0 ? 0 : (value > 255 ? 255 : value);
+		return static_cast<unsigned char>(value + 0.5f);
+	}
+}
+
+float Resampler::GetSupport(Filter filter)
+{
+	switch (filter)
+	{
+	case Filter::BILINEAR:
+		return 1;
+	case Filter::LANCZOS3:
+		return 3;
+	default:
+		return 0.5f;
+	}
+}
+
+float Resampler::Evaluate(Filter filter, float x)
+{
+	x = std::fabs(x);
+	switch (filter)
+	{
+	case Filter::BILINEAR:
+		return x < 1 ? 1 - x : 0;
+	case Filter::LANCZOS3:
+		return x < 3 ? Sinc(x) * Sinc(x / 3) : 0;
+	default:
+		return x <= 0.5f ? 1.0f : 0.0f;
+	}
+}
+
+void Resampler::ComputeWeights(int sourceSize, int targetSize, Filter filter, Weights &weights)
+{
+	// When shrinking, the filter is stretched to cover all the source pixels
+	float scale = static_cast<float>(sourceSize) / targetSize;
+	float filterScale = std::max(1.0f, scale);
+	float support = GetSupport(filter) * filterScale;
+
+	weights.taps = static_cast<int>(std::ceil(support * 2)) + 1;
+	weights.first.resize(targetSize);
+	weights.count.resize(targetSize);
+	weights.values.assign(static_cast<size_t>(targetSize) * weights.taps, 0);
+
+	for (int i = 0; i < targetSize; i++)
+	{
+		float center = (i + 0.5f) * scale;
+		int first = std::max(0, static_cast<int>(std::floor(center - support)));
+		int last = std::min(sourceSize - 1, static_cast<int>(std::ceil(center + support)));
+		last = std::min(last, first + weights.taps - 1);
+
+		float *values = &weights.values[static_cast<size_t>(i) * weights.taps];
+		float sum = 0;
+		for (int j = first; j <= last; j++)
+		{
+			values[j - first] = Evaluate(filter, (j + 0.5f - center) / filterScale);
+			sum += values[j - first];
+		}
+
+		// The box can fall between two pixels when enlarging
+		if (sum == 0)
+		{
+			int nearest = std::min(sourceSize - 1, std::max(0, static_cast<int>(center)));
+			first = last = nearest;
+			values[0] = sum = 1;
+		}
+
+		// Taps with no weight at the ends are skipped
+		int skipped = 0;
+		while (first < last && values[skipped] == 0)
+		{
+			first++;
+			skipped++;
+		}
+		while (last > first && values[last - first + skipped] == 0)
+			last--;
+
+		for (int j = 0; j <= last - first; j++)
+			values[j] = values[j + skipped] / sum;
+
+		weights.first[i] = first;
+		weights.count[i] = last - first + 1;
+	}
+}
+
+template <typename Function>
+void Resampler::ParallelFor(int count, int minChunk, Function function)
+{
+	int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	threadCount = std::max(1, std::min(threadCount, count / minChunk));
+	if (threadCount == 1)
+	{
+		function(0, count);
+		return;
+	}
+
+	int chunk = (count + threadCount - 1) / threadCount;
+	std::vector<std::future<void>> tasks;
+	for (int begin = chunk; begin < count; begin += chunk)
+		tasks.push_back(std::async(std::launch::async, function, begin, std::min(count, begin + chunk)));
+
+	// The first chunk runs on the calling thread
+	function(0, std::min(count, chunk));
+	for (auto &task : tasks)
+		task.get();
+}
+
+void Resampler::FilterRows(const unsigned char *source, int sourceWidth, unsigned int channels,
+	int begin, int end, const Weights &weights, int targetWidth, float *output)
+{
+	for (int y = begin; y < end; y++)
+	{
+		const unsigned char *row = source + static_cast<size_t>(y) * sourceWidth * channels;
+		float *outputRow = output + static_cast<size_t>(y) * targetWidth * channels;
+
+		for (int x = 0; x < targetWidth; x++)
+		{
+			const float *values = &weights.values[static_cast<size_t>(x) * weights.taps];
+			const unsigned char *pixel = row + static_cast<size_t>(weights.first[x]) * channels;
+			int count = weights.count[x];
+
+#ifdef RESAMPLER_SSE2
+			// A whole RGBA pixel fits in a register
+			if (channels == 4)
+			{
+				__m128i zero = _mm_setzero_si128();
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < count; k++)
+				{
+					int packed;
+					memcpy(&packed, pixel + k * 4, 4);
+					__m128i bytes = _mm_cvtsi32_si128(packed);
+					__m128i words = _mm_unpacklo_epi8(bytes, zero);
+					__m128 color = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+					sum = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(values[k])));
+				}
+				_mm_storeu_ps(outputRow + x * 4, sum);
+				continue;
+			}
+#endif
+
+			float sum[4] = { 0, 0, 0, 0 };
+			for (int k = 0; k < count; k++)
+			{
+				for (unsigned int c = 0; c < channels; c++)
+					sum[c] += values[k] * pixel[k * channels + c];
+			}
+			for (unsigned int c = 0; c < channels; c++)
+				outputRow[x * channels + c] = sum[c];
+		}
+	}
+}
+
+void Resampler::FilterColumns(const float *source, int rowSize, int begin, int end,
+	const Weights &weights, unsigned char *target)
+{
+	std::vector<float> sum(rowSize);
+
+	for (int y = begin; y < end; y++)
+	{
+		const float *values = &weights.values[static_cast<size_t>(y) * weights.taps];
+		const float *rows = source + static_cast<size_t>(weights.first[y]) * rowSize;
+		int count = weights.count[y];
+
+		// Each source row is added to the whole target row
+		std::fill(sum.begin(), sum.end(), 0.0f);
+		for (int k = 0; k < count; k++)
+		{
+			const float *row = rows + static_cast<size_t>(k) * rowSize;
+			int x = 0;
+#ifdef RESAMPLER_SSE2
+			__m128 weight = _mm_set1_ps(values[k]);
+			for (; x + 4 <= rowSize; x += 4)
+			{
+				__m128 value = _mm_mul_ps(_mm_loadu_ps(row + x), weight);
+				_mm_storeu_ps(&sum[x], _mm_add_ps(_mm_loadu_ps(&sum[x]), value));
+			}
+#endif
+			for (; x < rowSize; x++)
+				sum[x] += values[k] * row[x];
+		}
+
+		unsigned char *targetRow = target + static_cast<size_t>(y) * rowSize;
+		int x = 0;
+#ifdef RESAMPLER_SSE2
+		// Round half up like ToByte, clamp and pack 16 values at a time. The
+		// values below 0 truncate to 0 or less and saturate to 0 anyway
+		__m128 half = _mm_set1_ps(0.5f);
+		for (; x + 16 <= rowSize; x += 16)
+		{
+			__m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[x]), half));
+			__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[x + 4]), half));
+			__m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[x + 8]), half));
+			__m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(&sum[x + 12]), half));
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(targetRow + x), packed);
+		}
+#endif
+		for (; x < rowSize; x++)
+			targetRow[x] = ToByte(sum[x]);
+	}
+}
+
+void Resampler::Resize(const unsigned char *source, int sourceWidth, int sourceHeight,
+	unsigned char *target, int targetWidth, int targetHeight, unsigned int channels, Filter filter)
+{
+	if (!source || !target || sourceWidth <= 0 || sourceHeight <= 0
+		|| targetWidth <= 0 || targetHeight <= 0 || channels < 1 || channels > 4)
+	{
+		return;
+	}
+
+	Weights horizontal;
+	Weights vertical;
+	ComputeWeights(sourceWidth, targetWidth, filter, horizontal);
+	ComputeWeights(sourceHeight, targetHeight, filter, vertical);
+
+	// Rows filtered horizontally, kept as floats for the negative lobes of Lanczos
+	int rowSize = targetWidth * channels;
+	std::vector<float> rows(static_cast<size_t>(sourceHeight) * rowSize);
+
+	ParallelFor(sourceHeight, MIN_ROWS_PER_THREAD, [&](int begin, int end) {
+		FilterRows(source, sourceWidth, channels, begin, end, horizontal, targetWidth, rows.data());
+	});
+
+	ParallelFor(targetHeight, MIN_ROWS_PER_THREAD, [&](int begin, int end) {
+		FilterColumns(rows.data(), rowSize, begin, end, vertical, target);
+	});
+}
+
+void Resampler::ResizeNaive(const unsigned char *source, int sourceWidth, int sourceHeight,
+	unsigned char *target, int targetWidth, int targetHeight, unsigned int channels, Filter filter)
+{
+	if (!source || !target || sourceWidth <= 0 || sourceHeight <= 0
+		|| targetWidth <= 0 || targetHeight <= 0 || channels < 1 || channels > 4)
+	{
+		return;
+	}
+
+	Weights horizontal;
+	Weights vertical;
+	ComputeWeights(sourceWidth, targetWidth, filter, horizontal);
+	ComputeWeights(sourceHeight, targetHeight, filter, vertical);
+
+	for (int y = 0; y < targetHeight; y++)
+	{
+		const float *rowWeights = &vertical.values[static_cast<size_t>(y) * vertical.taps];
+		for (int x = 0; x < targetWidth; x++)
+		{
+			const float *columnWeights = &horizontal.values[static_cast<size_t>(x) * horizontal.taps];
+			for (unsigned int c = 0; c < channels; c++)
+			{
+				// Every source pixel of the window with the product of its weights
+				float sum = 0;
+				for (int i = 0; i < vertical.count[y]; i++)
+				{
+					const unsigned char *row = source + static_cast<size_t>(vertical.first[y] + i) * sourceWidth * channels;
+					for (int j = 0; j < horizontal.count[x]; j++)
+						sum += rowWeights[i] * columnWeights[j] * row[static_cast<size_t>(horizontal.first[x] + j) * channels + c];
+				}
+				target[(static_cast<size_t>(y) * targetWidth + x) * channels + c] = ToByte(sum);
+			}
+		}
+	}
+}
+
+void Resampler::Resize(const ImageBuffer &source, ImageBuffer &target, Filter filter)
+{
+	target.channels = source.channels;
+	target.data.resize(static_cast<size_t>(target.width) * target.height * target.channels);
+	Resize(source.data.data(), source.width, source.height, target.data.data(),
+		target.width, target.height, source.channels, filter);
+}
+
+void Resampler::Halve(const ImageBuffer &source, ImageBuffer &target)
+{
+	unsigned int channels = source.channels;
+	target.channels = channels;
+	target.data.resize(static_cast<size_t>(target.width) * target.height * channels);
+
+	ParallelFor(target.height, MIN_ROWS_PER_THREAD, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			const unsigned char *row0 = &source.data[static_cast<size_t>(2 * i) * source.width * channels];
+			const unsigned char *row1 = &source.data[static_cast<size_t>(std::min(2 * i + 1, source.height - 1)) * source.width * channels];
+			unsigned char *output = &target.data[static_cast<size_t>(i) * target.width * channels];
+
+			for (int j = 0; j < target.width; j++)
+			{
+				size_t left = static_cast<size_t>(2 * j) * channels;
+				size_t right = static_cast<size_t>(std::min(2 * j + 1, source.width - 1)) * channels;
+				for (unsigned int k = 0; k < channels; k++)
+				{
+					output[j * channels + k] = static_cast<unsigned char>(
+						(row0[left + k] + row0[right + k] + row1[left + k] + row1[right + k] + 2) / 4);
+				}
+			}
+		}
+	});
+}
+
+int Resampler::BuildPyramid(const ImageBuffer &image, ImageBuffer *levels, int count, size_t minPixels, Filter filter)
+{
+	const ImageBuffer *source = &image;
+	for (int level = 0; level < count; level++)
+	{
+		ImageBuffer &target = levels[level];
+		target.width = (source->width + 1) / 2;
+		target.height = (source->height + 1) / 2;
+		if (static_cast<size_t>(target.width) * target.height < minPixels)
+			return level;
+
+		if (filter == Filter::BOX)
+			Halve(*source, target);
+		else
+			Resize(*source, target, filter);
+		source = &target;
+	}
+
+	return count;
+}
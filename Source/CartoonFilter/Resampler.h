@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// 8 bit image with interleaved channels
+struct ImageBuffer
+{
+	std::vector<unsigned char> data;
+	int width;
+	int height;
+	unsigned int channels;
+};
+
+// Separable image resize on the CPU. The filter weights of each output row
+// and column are computed once per resize, then the rows are filtered
+// horizontally and the columns vertically, both split across threads
+class Resampler
+{
+public:
+	enum Filter { BOX = 0, BILINEAR = 1, LANCZOS3 = 2 };
+
+public:
+	// Resizes the source into the target, which has the size set
+	static void Resize(const ImageBuffer &source, ImageBuffer &target, Filter filter);
+
+	static void Resize(const unsigned char *source, int sourceWidth, int sourceHeight,
+		unsigned char *target, int targetWidth, int targetHeight, unsigned int channels, Filter filter);
+
+	// Same weights as Resize in a direct 2D loop on one thread, without SIMD.
+	// The baseline the separable resize is checked and timed against
+	static void ResizeNaive(const unsigned char *source, int sourceWidth, int sourceHeight,
+		unsigned char *target, int targetWidth, int targetHeight, unsigned int channels, Filter filter);
+
+	// Fills the levels with the image halved repeatedly, stops before the
+	// levels get smaller than the given number of pixels. Returns the levels
+	// built. The box filter averages each 2x2 block, the last row and column
+	// are repeated for odd sizes
+	static int BuildPyramid(const ImageBuffer &image, ImageBuffer *levels, int count, size_t minPixels, Filter filter = BOX);
+
+private:
+	// Weights of the source pixels used by each target pixel
+	struct Weights
+	{
+		std::vector<int> first;
+		std::vector<int> count;
+		std::vector<float> values;
+		int taps;
+	};
+
+	static float Evaluate(Filter filter, float x);
+	static float GetSupport(Filter filter);
+	static void ComputeWeights(int sourceSize, int targetSize, Filter filter, Weights &weights);
+
+	static void FilterRows(const unsigned char *source, int sourceWidth, unsigned int channels,
+		int begin, int end, const Weights &weights, int targetWidth, float *output);
+	static void FilterColumns(const float *source, int rowSize, int begin, int end,
+		const Weights &weights, unsigned char *target);
+
+	// Exact 2x2 average used by the box pyramid
+	static void Halve(const ImageBuffer &source, ImageBuffer &target);
+
+	// Runs the function over the range split in chunks on several threads
+	template <typename Function>
+	static void ParallelFor(int count, int minChunk, Function function);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded queue between a single producer thread and a single consumer
+// thread, without locks. The head is only written by the consumer and the
+// tail only by the producer, each on its own cache line
+template <class T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+		: items(capacity), head(0), tail(0)
+	{
+	}
+
+	// Returns false if the queue is full
+	bool TryPush(const T &item)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		if (position - head.load(std::memory_order_acquire) == items.size())
+			return false;
+
+		items[position % items.size()] = item;
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if the queue is empty
+	bool TryPop(T &item)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = items[position % items.size()];
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Items in the queue, only exact on the producer or the consumer thread
+	size_t GetSize() const
+	{
+		size_t position = head.load(std::memory_order_acquire);
+		return tail.load(std::memory_order_acquire) - position;
+	}
+
+	size_t GetCapacity() const
+	{
+		return items.size();
+	}
+
+private:
+	std::vector<T> items;
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
@@ -0,0 +1,175 @@
+#include "StripFilter.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+namespace
+{
+	// Memory of the pipeline for each pixel of the window: the image, the
+	// grayscale, gradient and edge masks, the two integrals and the result
+	const size_t BYTES_PER_PIXEL = 32;
+
+	// Pixels sampled for the palette
+	const size_t MAX_SAMPLES = 1 << 20;
+}
+
+StripFilter::StripFilter()
+{
+	width = 0;
+	channels = 0;
+	stripRows = 0;
+}
+
+int StripFilter::GetStripRows() const
+{
+	return stripRows;
+}
+
+bool StripFilter::Run(const std::string &input, const std::string &output, const CpuPipeline::Parameters &parameters)
+{
+	PnmReader reader;
+	if (!reader.Open(input))
+	{
+		std::cout << "Could not read " << input << ", expected a binary PPM (P6) or PAM (P7) image" << std::endl;
+		return false;
+	}
+
+	width = reader.GetWidth();
+	channels = reader.GetChannels();
+	int height = reader.GetHeight();
+
+	PnmWriter writer;
+	if (!writer.Open(output, width, height, channels))
+	{
+		std::cout << "Could not write " << output << std::endl;
+		return false;
+	}
+
+	if (!PrepareColoring(reader, parameters))
+	{
+		std::cout << "Could not read the pixels of " << input << std::endl;
+		return false;
+	}
+
+	// The window holds the strip and the rows read by the kernels above and below it
+	int halo = parameters.dilationRadius + std::max(parameters.thresholdRadius, 1);
+	size_t budgetRows = STRIP_MEMORY / (static_cast<size_t>(width) * BYTES_PER_PIXEL);
+	stripRows = std::max(static_cast<int>(std::min(budgetRows, static_cast<size_t>(height))) - 2 * halo, 1);
+
+	size_t rowSize = static_cast<size_t>(width) * channels;
+	window.resize(std::min(stripRows + 2 * halo, height) * rowSize);
+
+	int windowTop = 0;
+	int windowRows = 0;
+	for (int begin = 0; begin < height; begin += stripRows)
+	{
+		int end = std::min(begin + stripRows, height);
+		int top = std::max(begin - halo, 0);
+		int bottom = std::min(end + halo, height);
+
+		// The halo above the strip is kept from the previous one
+		int dropped = top - windowTop;
+		if (dropped > 0)
+		{
+			memmove(window.data(), window.data() + dropped * rowSize, (windowRows - dropped) * rowSize);
+			windowTop = top;
+			windowRows -= dropped;
+		}
+
+		if (!reader.ReadRows(window.data() + windowRows * rowSize, bottom - windowTop - windowRows))
+		{
+			std::cout << "Could not read the rows " << windowTop + windowRows << "-" << bottom << " of " << input << std::endl;
+			return false;
+		}
+		windowRows = bottom - windowTop;
+
+		if (!FilterStrip(parameters, windowRows, begin - windowTop, end - windowTop, writer))
+		{
+			std::cout << "Could not write the rows " << begin << "-" << end << " of " << output << std::endl;
+			return false;
+		}
+	}
+
+	if (!writer.Close())
+	{
+		std::cout << "Could not write " << output << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool StripFilter::PrepareColoring(PnmReader &reader, const CpuPipeline::Parameters &parameters)
+{
+	if (parameters.coloring != CpuPipeline::PALETTE && parameters.coloring != CpuPipeline::KMEANS)
+		return true;
+
+	// Every step-th pixel of every step-th row
+	int height = reader.GetHeight();
+	double pixelCount = static_cast<double>(width) * height;
+	int step = std::max(1, static_cast<int>(std::ceil(std::sqrt(pixelCount / MAX_SAMPLES))));
+
+	std::vector<unsigned char> row(static_cast<size_t>(width) * channels);
+	std::vector<unsigned char> samples;
+	for (int i = 0; i < height; i++)
+	{
+		if (!reader.ReadRows(row.data(), 1))
+			return false;
+
+		if (i % step)
+			continue;
+
+		for (int j = 0; j < width; j += step)
+			samples.insert(samples.end(), &row[j * channels], &row[j * channels] + channels);
+	}
+
+	if (!reader.Rewind())
+		return false;
+
+	size_t sampleCount = samples.size() / channels;
+	if (parameters.coloring == CpuPipeline::PALETTE)
+	{
+		palette.Build(samples.data(), sampleCount, channels, parameters.paletteColors);
+		return true;
+	}
+
+	// The samples keep the colors of the edges, finding the edges would take
+	// another pass over the file. The edges are made black in each strip anyway
+	kmeans.Reset();
+	kmeans.Apply(samples.data(), sampleCount, channels, parameters.paletteColors);
+	palette.SetPalette(kmeans.GetPalette());
+	return true;
+}
+
+bool StripFilter::FilterStrip(const CpuPipeline::Parameters &parameters, int windowRows, int begin, int end, PnmWriter &writer)
+{
+	// The window is reused for the next rows, so the stages are always discarded
+	pipeline.SetImage(window.data(), width, windowRows, channels);
+	pipeline.Invalidate();
+
+	size_t rowSize = static_cast<size_t>(width) * channels;
+	if (parameters.coloring == CpuPipeline::LEVELS || parameters.coloring == CpuPipeline::SEGMENTATION)
+	{
+		return pipeline.Run(parameters, result) && writer.WriteRows(&result[begin * rowSize], end - begin);
+	}
+
+	// Edges of the window, colored with the palette of the whole image
+	const std::vector<unsigned char> &mask = pipeline.GetEdges(parameters.thresholdRadius, parameters.dilationRadius);
+	if (mask.empty())
+		return false;
+
+	result.resize((end - begin) * rowSize);
+	for (int i = begin; i < end; i++)
+	{
+		unsigned char *output = &result[(i - begin) * rowSize];
+		for (int j = 0; j < width; j++)
+		{
+			memset(&output[j * channels], mask[static_cast<size_t>(i) * width + j], channels);
+		}
+		palette.SubtractAndMap(&window[i * rowSize], output, output, width, channels);
+	}
+
+	return writer.WriteRows(result.data(), end - begin);
+}
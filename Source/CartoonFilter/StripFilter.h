@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <CartoonFilter\CpuPipeline.h>
+#include <CartoonFilter\PnmFile.h>
+
+// Out of core CPU filter for images larger than the memory or the texture
+// size limit. The image is read from a PNM file in strips of full rows,
+// each strip is filtered together with the rows above and below it that
+// the kernels read, and the filtered rows are written before the next
+// strip is read. The memory used depends on the width of the image only.
+// The color levels match the filter of the whole image. The palette and
+// the k-means centroids are fitted on pixels sampled in a first pass,
+// and the segmentation grows its regions inside each strip
+class StripFilter
+{
+public:
+	// Memory for the rows of a strip and the stages of the filter
+	static const size_t STRIP_MEMORY = 256 * 1024 * 1024;
+
+public:
+	StripFilter();
+
+public:
+	// Filters the input file into the output file. Returns false if a file
+	// can't be read or written, the reason is printed
+	bool Run(const std::string &input, const std::string &output, const CpuPipeline::Parameters &parameters);
+
+	// Rows filtered at once in the last run, without the halo
+	int GetStripRows() const;
+
+private:
+	// Builds the palette from pixels sampled on a grid over the whole image
+	bool PrepareColoring(PnmReader &reader, const CpuPipeline::Parameters &parameters);
+
+	// Filters the rows of the window between begin and end into the output
+	bool FilterStrip(const CpuPipeline::Parameters &parameters, int windowRows, int begin, int end, PnmWriter &writer);
+
+private:
+	int width;
+	unsigned int channels;
+	int stripRows;
+
+	// Rows of the image held in memory, the strip and its halo
+	std::vector<unsigned char> window;
+	std::vector<unsigned char> result;
+
+	CpuPipeline pipeline;
+	PaletteQuantizer palette;
+	KMeansQuantizer kmeans;
+};
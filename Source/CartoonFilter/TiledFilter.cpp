@@ -0,0 +1,389 @@
+#include "TiledFilter.h"
+
+#include <cstring>
+#include <future>
+#include <algorithm>
+
+#include <include/gl.h>
+
+namespace
+{
+	// Levels smaller than a tile are not built
+	const size_t MIN_LEVEL_PIXELS = TiledFilter::TILE_SIZE * TiledFilter::TILE_SIZE;
+
+	bool SameParameters(const CpuPipeline::Parameters &a, const CpuPipeline::Parameters &b)
+	{
+		return a.thresholdRadius == b.thresholdRadius && a.dilationRadius == b.dilationRadius
+			&& a.coloring == b.coloring && a.colorLevels == b.colorLevels && a.paletteColors == b.paletteColors;
+	}
+}
+
+TiledFilter::TiledFilter()
+{
+	stop = false;
+	hasParameters = false;
+	memset(&parameters, 0, sizeof(parameters));
+	memset(&runParameters, 0, sizeof(runParameters));
+	resetColoring = false;
+	generation = 0;
+	requestLevel = -1;
+	coloringLevel = -1;
+
+	thread = std::thread(&TiledFilter::Run, this);
+}
+
+TiledFilter::~TiledFilter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		generation++;
+	}
+	wake.notify_one();
+	thread.join();
+}
+
+void TiledFilter::SetImage(const unsigned char *data, int width, int height, unsigned int channels)
+{
+	std::shared_ptr<ImageBuffer> copy = std::make_shared<ImageBuffer>();
+	copy->data.assign(data, data + static_cast<size_t>(width) * height * channels);
+	copy->width = width;
+	copy->height = height;
+	copy->channels = channels;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingImage = copy;
+		levels = nullptr;
+		Clear();
+	}
+	wake.notify_one();
+}
+
+bool TiledFilter::SetParameters(const CpuPipeline::Parameters &parameters)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (hasParameters && SameParameters(this->parameters, parameters))
+		return false;
+
+	hasParameters = true;
+	this->parameters = parameters;
+	Clear();
+	return true;
+}
+
+void TiledFilter::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Clear();
+}
+
+void TiledFilter::Clear()
+{
+	// Called with the mutex locked, the running work is cancelled
+	generation++;
+	resetColoring = true;
+	requested.clear();
+	finished.clear();
+	recentTiles.clear();
+	tiles.clear();
+}
+
+std::shared_ptr<const TiledFilter::Levels> TiledFilter::GetLevels() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return levels;
+}
+
+TiledFilter::TileKey TiledFilter::GetKey(int level, int column, int row)
+{
+	return (static_cast<TileKey>(level) << 48) | (static_cast<TileKey>(row) << 24) | static_cast<TileKey>(column);
+}
+
+const TiledFilter::Tile* TiledFilter::FindTile(int level, int column, int row)
+{
+	auto found = tiles.find(GetKey(level, column, row));
+	if (found == tiles.end())
+		return nullptr;
+
+	recentTiles.splice(recentTiles.begin(), recentTiles, found->second.use);
+	return &found->second.tile;
+}
+
+bool TiledFilter::Update(int level, int left, int top, int right, int bottom)
+{
+	// The finished tiles are cached and the request is made again under the
+	// same lock, so the worker can't take a tile that was just finished
+	std::lock_guard<std::mutex> lock(mutex);
+
+	bool added = !finished.empty();
+	for (auto &done : finished)
+	{
+		if (tiles.find(done.first) != tiles.end())
+			continue;
+
+		recentTiles.push_front(done.first);
+		CachedTile &cached = tiles[done.first];
+		cached.tile = std::move(done.second);
+		cached.use = recentTiles.begin();
+	}
+	finished.clear();
+	requested.clear();
+
+	// Drop the least recently used tiles
+	while (tiles.size() > MAX_CACHED_TILES)
+	{
+		tiles.erase(recentTiles.back());
+		recentTiles.pop_back();
+	}
+
+	if (!hasParameters || !levels || level < 0 || level >= static_cast<int>(levels->size()))
+		return added;
+
+	const ImageBuffer &source = (*levels)[level];
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, source.width);
+	bottom = std::min(bottom, source.height);
+	if (left >= right || top >= bottom)
+		return added;
+
+	// Tiles in the rectangle that aren't cached or being filtered, closest to its center first
+	for (int row = top / TILE_SIZE; row <= (bottom - 1) / TILE_SIZE; row++)
+	{
+		for (int column = left / TILE_SIZE; column <= (right - 1) / TILE_SIZE; column++)
+		{
+			TileKey key = GetKey(level, column, row);
+			if (tiles.find(key) == tiles.end() && std::find(filtering.begin(), filtering.end(), key) == filtering.end())
+				requested.push_back(std::make_pair(column, row));
+		}
+	}
+
+	int centerX = (left + right) / 2;
+	int centerY = (top + bottom) / 2;
+	auto distance = [centerX, centerY](const std::pair<int, int> &tile) {
+		int dx = tile.first * TILE_SIZE + TILE_SIZE / 2 - centerX;
+		int dy = tile.second * TILE_SIZE + TILE_SIZE / 2 - centerY;
+		return dx * dx + dy * dy;
+	};
+	std::sort(requested.begin(), requested.end(), [&distance](const std::pair<int, int> &a, const std::pair<int, int> &b) {
+		return distance(a) < distance(b);
+	});
+
+	// Another level cancels the tiles in progress
+	requestLevel = level;
+	if (!requested.empty())
+		wake.notify_one();
+
+	return added;
+}
+
+void TiledFilter::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (!stop)
+	{
+		// A new image is split in levels before any tile is filtered
+		if (pendingImage)
+		{
+			std::shared_ptr<ImageBuffer> image = pendingImage;
+			pendingImage = nullptr;
+			lock.unlock();
+
+			std::shared_ptr<Levels> built = std::make_shared<Levels>();
+			if (image->channels >= 3 && image->width > 0 && image->height > 0)
+			{
+				built->resize(MAX_LEVELS);
+				(*built)[0] = std::move(*image);
+				built->resize(1 + Resampler::BuildPyramid((*built)[0], built->data() + 1, MAX_LEVELS - 1, MIN_LEVEL_PIXELS));
+			}
+
+			// Dropped if another image came in the meantime
+			lock.lock();
+			if (!pendingImage && !stop)
+			{
+				levels = built;
+				glfwPostEmptyEvent();
+			}
+			continue;
+		}
+
+		if (requested.empty())
+		{
+			wake.wait(lock);
+			continue;
+		}
+
+		if (resetColoring)
+		{
+			coloringLevel = -1;
+			resetColoring = false;
+		}
+
+		// As many tiles as there are cores at once
+		unsigned int runGeneration = generation;
+		int runLevel = requestLevel;
+		runParameters = parameters;
+		runLevels = levels;
+		size_t count = std::min(requested.size(), static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency())));
+		std::vector<std::pair<int, int>> batch(requested.begin(), requested.begin() + count);
+		requested.erase(requested.begin(), requested.begin() + count);
+		for (auto &tile : batch)
+			filtering.push_back(GetKey(runLevel, tile.first, tile.second));
+		lock.unlock();
+
+		CancelCheck current = [this, runGeneration, runLevel]() {
+			return generation == runGeneration && requestLevel == runLevel;
+		};
+
+		// Each tile reads only the level and the shared palette
+		std::vector<Tile> filtered(count);
+		std::vector<unsigned char> completed(count, 0);
+		if (PrepareColoring(runLevel, current))
+		{
+			std::vector<std::future<void>> tasks;
+			for (size_t i = 0; i < count; i++)
+			{
+				tasks.push_back(std::async(std::launch::async, [this, runLevel, &batch, &filtered, &completed, &current, i]() {
+					completed[i] = FilterTile(runLevel, batch[i].first, batch[i].second, filtered[i], current);
+				}));
+			}
+			for (auto &task : tasks)
+				task.get();
+		}
+
+		lock.lock();
+		filtering.clear();
+		if (generation == runGeneration)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (completed[i])
+					finished.push_back(std::make_pair(GetKey(runLevel, batch[i].first, batch[i].second), std::move(filtered[i])));
+			}
+		}
+
+		// The render loop can be waiting for events
+		if (!stop)
+			glfwPostEmptyEvent();
+	}
+}
+
+bool TiledFilter::PrepareColoring(int level, const CancelCheck &current)
+{
+	if (runParameters.coloring != CpuPipeline::PALETTE && runParameters.coloring != CpuPipeline::KMEANS)
+		return true;
+
+	// The k-means centroids are the same for all the levels
+	if (runParameters.coloring == CpuPipeline::KMEANS)
+		level = static_cast<int>(runLevels->size()) - 1;
+
+	if (coloringLevel == level)
+		return true;
+
+	const ImageBuffer &source = (*runLevels)[level];
+	size_t pixelCount = static_cast<size_t>(source.width) * source.height;
+
+	if (runParameters.coloring == CpuPipeline::PALETTE)
+	{
+		palette.Build(source.data.data(), pixelCount, source.channels, runParameters.paletteColors);
+		coloringLevel = level;
+		return true;
+	}
+
+	// The centroids are fitted on the level with the edges made black, like the whole filter
+	CpuPipeline pipeline;
+	pipeline.SetImage(source.data.data(), source.width, source.height, source.channels);
+	CpuPipeline::Parameters scaled = CpuPipeline::ScaleParameters(runParameters, level);
+	auto progress = [&current](float) { return current(); };
+	const std::vector<unsigned char> &mask = pipeline.GetEdges(scaled.thresholdRadius, scaled.dilationRadius, progress);
+	if (mask.empty())
+		return false;
+
+	std::vector<unsigned char> colors = source.data;
+	for (size_t i = 0; i < mask.size(); i++)
+	{
+		if (mask[i])
+			memset(&colors[i * source.channels], 0, 3);
+	}
+
+	if (!kmeans.Apply(colors.data(), pixelCount, source.channels, runParameters.paletteColors, progress))
+		return false;
+
+	palette.SetPalette(kmeans.GetPalette());
+	coloringLevel = level;
+	return true;
+}
+
+bool TiledFilter::FilterTile(int level, int column, int row, Tile &tile, const CancelCheck &current) const
+{
+	const ImageBuffer &source = (*runLevels)[level];
+	CpuPipeline::Parameters scaled = CpuPipeline::ScaleParameters(runParameters, level);
+
+	tile.x = column * TILE_SIZE;
+	tile.y = row * TILE_SIZE;
+	tile.image.width = std::min(TILE_SIZE, source.width - tile.x);
+	tile.image.height = std::min(TILE_SIZE, source.height - tile.y);
+	tile.image.channels = source.channels;
+
+	// The dilation reads the edges around the tile, and each edge reads the
+	// grayscale in its threshold window and sobel kernel. The part is clipped
+	// to the level, like the windows of the whole filter, so the result is the same
+	int halo = scaled.dilationRadius + std::max(scaled.thresholdRadius, 1);
+	int left = std::max(tile.x - halo, 0);
+	int top = std::max(tile.y - halo, 0);
+	int right = std::min(tile.x + tile.image.width + halo, source.width);
+	int bottom = std::min(tile.y + tile.image.height + halo, source.height);
+
+	unsigned int channels = source.channels;
+	int partWidth = right - left;
+	int partHeight = bottom - top;
+	size_t partRowSize = static_cast<size_t>(partWidth) * channels;
+	std::vector<unsigned char> part(partRowSize * partHeight);
+	for (int i = 0; i < partHeight; i++)
+	{
+		memcpy(&part[i * partRowSize], &source.data[(static_cast<size_t>(top + i) * source.width + left) * channels], partRowSize);
+	}
+
+	CpuPipeline pipeline;
+	pipeline.SetImage(part.data(), partWidth, partHeight, channels);
+	auto progress = [&current](float) { return current(); };
+
+	size_t rowSize = static_cast<size_t>(tile.image.width) * channels;
+	tile.image.data.resize(rowSize * tile.image.height);
+	int offsetX = tile.x - left;
+	int offsetY = tile.y - top;
+
+	// The color levels don't depend on the rest of the image
+	if (runParameters.coloring == CpuPipeline::LEVELS || runParameters.coloring == CpuPipeline::SEGMENTATION)
+	{
+		std::vector<unsigned char> result;
+		if (!pipeline.Run(scaled, result, progress))
+			return false;
+
+		for (int i = 0; i < tile.image.height; i++)
+		{
+			memcpy(&tile.image.data[i * rowSize], &result[(static_cast<size_t>(offsetY + i) * partWidth + offsetX) * channels], rowSize);
+		}
+		return true;
+	}
+
+	// Edges of the part, colored with the palette of the level
+	const std::vector<unsigned char> &mask = pipeline.GetEdges(scaled.thresholdRadius, scaled.dilationRadius, progress);
+	if (mask.empty())
+		return false;
+
+	for (int i = 0; i < tile.image.height; i++)
+	{
+		size_t offset = static_cast<size_t>(offsetY + i) * partWidth + offsetX;
+		unsigned char *output = &tile.image.data[i * rowSize];
+		for (int j = 0; j < tile.image.width; j++)
+		{
+			memset(&output[j * channels], mask[offset + j], channels);
+		}
+		palette.SubtractAndMap(&part[offset * channels], output, output, tile.image.width, channels);
+	}
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <CartoonFilter\CpuPipeline.h>
+#include <CartoonFilter\Resampler.h>
+
+// Pull based CPU filter for a zoomed view of the image. Each level of the
+// image pyramid is split in square tiles and only the tiles asked for are
+// filtered, each one from its part of the level grown by the halo read by
+// the kernels. The tiles are cached until the image or the parameters change,
+// the least recently used ones are dropped when the cache is full.
+// The color levels and the palette match the filter of the whole level.
+// The segmentation grows its regions inside each tile and its halo, and
+// the k-means centroids are fitted on the smallest level.
+// The pyramid, the palettes and the tiles are built on a worker thread. The
+// render thread asks for the tiles of its view and takes the finished ones
+// without waiting, a new image, new parameters or another level cancel the
+// work in progress, which stops at the next row
+class TiledFilter
+{
+public:
+	static const int TILE_SIZE = 256;
+
+	// Levels of the pyramid, including the full image
+	static const int MAX_LEVELS = 8;
+
+	// 64 MB of RGBA tiles
+	static const size_t MAX_CACHED_TILES = 256;
+
+	// Filtered part of a level, smaller at the right and bottom borders
+	struct Tile
+	{
+		ImageBuffer image;
+		int x;
+		int y;
+	};
+
+	// Level 0 is a copy of the image
+	typedef std::vector<ImageBuffer> Levels;
+
+public:
+	TiledFilter();
+	~TiledFilter();
+
+public:
+	// Copies the image, its pyramid is built on the worker. Drops the cached tiles
+	void SetImage(const unsigned char *data, int width, int height, unsigned int channels);
+
+	// Drops the cached tiles if the parameters changed, in which case it returns true
+	bool SetParameters(const CpuPipeline::Parameters &parameters);
+
+	// Drops the cached tiles and the palettes, all the tiles are filtered again
+	void Invalidate();
+
+	// Returns the pyramid of the image, or nullptr until the worker has built it
+	std::shared_ptr<const Levels> GetLevels() const;
+
+	// Takes the tiles finished by the worker and asks it for the missing tiles that
+	// intersect the rectangle, given in pixels of the level with exclusive ends,
+	// the closest ones to the center first. Never waits for the worker, which
+	// wakes the render loop when more tiles are done. Returns true if tiles were added
+	bool Update(int level, int left, int top, int right, int bottom);
+
+	// Returns the cached tile or nullptr, the tile becomes the most recently used
+	const Tile* FindTile(int level, int column, int row);
+
+private:
+	typedef unsigned long long TileKey;
+
+	struct CachedTile
+	{
+		Tile tile;
+		std::list<TileKey>::iterator use;
+	};
+
+	// Returns false when the work in progress has to stop
+	typedef std::function<bool()> CancelCheck;
+
+	static TileKey GetKey(int level, int column, int row);
+
+	void Run();
+	void Clear();
+
+	// Builds the palette shared by the tiles of the level, returns false if it was cancelled
+	bool PrepareColoring(int level, const CancelCheck &current);
+
+	// Filters the tile from its part of the level, runs on several threads at once.
+	// Returns false if it was cancelled
+	bool FilterTile(int level, int column, int row, Tile &tile, const CancelCheck &current) const;
+
+private:
+	std::thread thread;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool stop;
+
+	// Shared with the worker. The image waits there until its pyramid is built
+	std::shared_ptr<ImageBuffer> pendingImage;
+	std::shared_ptr<const Levels> levels;
+	bool hasParameters;
+	CpuPipeline::Parameters parameters;
+	bool resetColoring;
+
+	// Missing tiles of the view not taken by the worker yet, and the ones it is filtering
+	std::vector<std::pair<int, int>> requested;
+	std::vector<TileKey> filtering;
+	std::vector<std::pair<TileKey, Tile>> finished;
+
+	// Increased when the tiles are dropped, the running work stops when
+	// it changes or when another level is asked for
+	std::atomic<unsigned int> generation;
+	std::atomic<int> requestLevel;
+
+	// Only used on the worker thread. The pyramid and the parameters of the
+	// running work, and the level the palette was built for, -1 if there is none
+	std::shared_ptr<const Levels> runLevels;
+	CpuPipeline::Parameters runParameters;
+	int coloringLevel;
+	PaletteQuantizer palette;
+	KMeansQuantizer kmeans;
+
+	// Only used on the render thread, most recently used tiles first
+	std::list<TileKey> recentTiles;
+	std::unordered_map<TileKey, CachedTile> tiles;
+};
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "VideoFilter.h"
+
+#include <thread>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+
+namespace
+{
+	// Time between two reports
+	const std::chrono::seconds REPORT_INTERVAL(1);
+
+	// A waiting stage yields this many times, then sleeps between the checks
+	const int SPIN_COUNT = 64;
+	const std::chrono::microseconds WAIT_TIME(200);
+
+	long long GetMicroseconds(const std::chrono::steady_clock::time_point &start)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void Wait(int &spins)
+	{
+		if (++spins < SPIN_COUNT)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(WAIT_TIME);
+	}
+
+	unsigned char Clamp(int value)
+	{
+		return static_cast<unsigned char>(value < 0 ? 0 : (value > 255 ? 255 : value));
+	}
+}
+
+VideoFilter::VideoFilter()
+	: freeFrames(FRAME_COUNT), decodedFrames(QUEUE_FRAMES), filteredFrames(QUEUE_FRAMES)
+{
+	stop = false;
+	framesWritten = 0;
+	reportFrames = 0;
+
+	for (StageStats *stats : { &decodeStats, &filterStats, &encodeStats })
+	{
+		stats->busyMicroseconds = 0;
+		stats->queuedFrames = 0;
+		stats->frames = 0;
+	}
+}
+
+bool VideoFilter::Run(const std::string &input, const std::string &output, const CpuPipeline::Parameters &parameters)
+{
+	// Nothing but the video is written on stdout
+	Y4MReader reader;
+	if (!reader.Open(input))
+	{
+		std::cerr << "Could not read " << input << ", expected a 4:2:0 Y4M stream" << std::endl;
+		return false;
+	}
+
+	Y4MWriter writer;
+	if (!writer.Open(output, reader.GetHeader()))
+	{
+		std::cerr << "Could not write " << output << std::endl;
+		return false;
+	}
+
+	// All the frames start free
+	Frame *frame = nullptr;
+	while (freeFrames.TryPop(frame) || decodedFrames.TryPop(frame) || filteredFrames.TryPop(frame))
+	{
+	}
+	frames.assign(FRAME_COUNT, Frame());
+	for (Frame &free : frames)
+		freeFrames.TryPush(&free);
+
+	stop = false;
+	framesWritten = 0;
+	reportFrames = 0;
+	startTime = std::chrono::steady_clock::now();
+	reportTime = startTime;
+
+	std::thread decoder(&VideoFilter::Decode, this, std::ref(reader));
+	std::thread filter(&VideoFilter::Filter, this, std::cref(parameters));
+	bool written = Encode(writer);
+
+	decoder.join();
+	filter.join();
+	written = writer.Close() && written;
+	Report(true);
+
+	if (reader.HasFailed())
+	{
+		std::cerr << "The stream " << input << " ends in the middle of a frame" << std::endl;
+		return false;
+	}
+	if (!written)
+	{
+		std::cerr << "Could not write " << output << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool VideoFilter::Push(SpscQueue<Frame*> &queue, Frame *frame)
+{
+	int spins = 0;
+	while (!queue.TryPush(frame))
+	{
+		if (stop)
+			return false;
+		Wait(spins);
+	}
+	return true;
+}
+
+bool VideoFilter::Pop(SpscQueue<Frame*> &queue, Frame *&frame, StageStats *stats)
+{
+	if (stats)
+		stats->queuedFrames += queue.GetSize();
+
+	int spins = 0;
+	while (!queue.TryPop(frame))
+	{
+		if (stop)
+			return false;
+		Wait(spins);
+	}
+	return true;
+}
+
+void VideoFilter::Decode(Y4MReader &reader)
+{
+	Frame *frame = nullptr;
+	while (Pop(freeFrames, frame, nullptr))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool decoded = reader.ReadFrame(frame->yuv);
+		decodeStats.busyMicroseconds += GetMicroseconds(start);
+
+		if (!decoded)
+			break;
+
+		decodeStats.frames++;
+		if (!Push(decodedFrames, frame))
+			return;
+	}
+
+	// The end of the stream, or of the run if it was stopped
+	Push(decodedFrames, nullptr);
+}
+
+void VideoFilter::Filter(const CpuPipeline::Parameters &parameters)
+{
+	std::vector<unsigned char> result;
+
+	// Consecutive frames share most of their regions
+	pipeline.SetTemporal(true);
+
+	Frame *frame = nullptr;
+	while (Pop(decodedFrames, frame, &filterStats))
+	{
+		if (!frame)
+			break;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int width = frame->yuv.width;
+		int height = frame->yuv.height;
+
+		// Every frame is a new image, even in a buffer used before
+		if (parameters.coloring == CpuPipeline::LEVELS)
+		{
+			pipeline.SetImage(frame->yuv.planes[0].data(), width, height, 1);
+			pipeline.Invalidate();
+			const std::vector<unsigned char> &mask = pipeline.GetEdges(parameters.thresholdRadius, parameters.dilationRadius);
+
+			quantizer.SetLevels(parameters.colorLevels);
+			quantizer.Apply(frame->yuv, mask.data());
+		}
+		else
+		{
+			frame->rgb.resize(static_cast<size_t>(width) * height * 3);
+			ToRgb(frame->yuv, frame->rgb.data());
+
+			pipeline.SetImage(frame->rgb.data(), width, height, 3);
+			pipeline.Invalidate();
+			pipeline.Run(parameters, result);
+			ToYuv(result.data(), frame->yuv);
+		}
+
+		filterStats.busyMicroseconds += GetMicroseconds(start);
+		filterStats.frames++;
+		if (!Push(filteredFrames, frame))
+			return;
+	}
+
+	Push(filteredFrames, nullptr);
+}
+
+bool VideoFilter::Encode(Y4MWriter &writer)
+{
+	Frame *frame = nullptr;
+	while (Pop(filteredFrames, frame, &encodeStats) && frame)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool written = writer.WriteFrame(frame->yuv);
+		encodeStats.busyMicroseconds += GetMicroseconds(start);
+
+		// The other stages stop at their next wait
+		if (!written)
+		{
+			stop = true;
+			return false;
+		}
+
+		encodeStats.frames++;
+		framesWritten++;
+
+		// There is room for all the frames, so this never waits
+		Push(freeFrames, frame);
+
+		if (std::chrono::steady_clock::now() - reportTime >= REPORT_INTERVAL)
+			Report(false);
+	}
+
+	return true;
+}
+
+void VideoFilter::Report(bool final)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (final)
+	{
+		double seconds = std::chrono::duration<double>(now - startTime).count();
+		std::cerr << "Video: " << framesWritten << " frames in " << seconds << "s, "
+			<< (seconds > 0 ? framesWritten / seconds : 0) << " fps" << std::endl;
+		return;
+	}
+
+	double seconds = std::chrono::duration<double>(now - reportTime).count();
+	int frames = framesWritten - reportFrames;
+	reportTime = now;
+	reportFrames = framesWritten;
+
+	// Frames waiting in the queue when the consumer asked for the next one,
+	// a full queue means the consumer is the slowest stage
+	auto getQueued = [](StageStats &stats, int frames) {
+		return frames > 0 ? static_cast<double>(stats.queuedFrames.exchange(0)) / frames : 0.0;
+	};
+	auto getTime = [](StageStats &stats, int frames) {
+		return frames > 0 ? stats.busyMicroseconds.exchange(0) / 1000.0 / frames : 0.0;
+	};
+
+	int decoded = decodeStats.frames.exchange(0);
+	int filtered = filterStats.frames.exchange(0);
+	int encoded = encodeStats.frames.exchange(0);
+
+	std::cerr << "Video: " << framesWritten << " frames, " << (seconds > 0 ? frames / seconds : 0) << " fps"
+		<< ", queued decoded " << getQueued(filterStats, filtered) << "/" << QUEUE_FRAMES
+		<< ", filtered " << getQueued(encodeStats, encoded) << "/" << QUEUE_FRAMES
+		<< ", ms per frame decode " << getTime(decodeStats, decoded)
+		<< ", filter " << getTime(filterStats, filtered)
+		<< ", encode " << getTime(encodeStats, encoded) << std::endl;
+}
+
+void VideoFilter::ToRgb(const YuvFrame &yuv, unsigned char *rgb)
+{
+	int chromaWidth = yuv.GetChromaWidth();
+	for (int i = 0; i < yuv.height; i++)
+	{
+		const unsigned char *luma = &yuv.planes[0][static_cast<size_t>(i) * yuv.width];
+		const unsigned char *blue = &yuv.planes[1][static_cast<size_t>(i / 2) * chromaWidth];
+		const unsigned char *red = &yuv.planes[2][static_cast<size_t>(i / 2) * chromaWidth];
+		unsigned char *output = rgb + static_cast<size_t>(i) * yuv.width * 3;
+
+		for (int j = 0; j < yuv.width; j++)
+		{
+			int y = 298 * (luma[j] - 16) + 128;
+			int u = blue[j / 2] - 128;
+			int v = red[j / 2] - 128;
+			output[j * 3] = Clamp((y + 409 * v) >> 8);
+			output[j * 3 + 1] = Clamp((y - 100 * u - 208 * v) >> 8);
+			output[j * 3 + 2] = Clamp((y + 516 * u) >> 8);
+		}
+	}
+}
+
+void VideoFilter::ToYuv(const unsigned char *rgb, YuvFrame &yuv)
+{
+	for (size_t i = 0; i < yuv.planes[0].size(); i++)
+	{
+		const unsigned char *pixel = rgb + i * 3;
+		yuv.planes[0][i] = Clamp(((66 * pixel[0] + 129 * pixel[1] + 25 * pixel[2] + 128) >> 8) + 16);
+	}
+
+	// The chroma of each 2x2 block comes from its average color
+	int chromaWidth = yuv.GetChromaWidth();
+	int chromaHeight = yuv.GetChromaHeight();
+	for (int i = 0; i < chromaHeight; i++)
+	{
+		for (int j = 0; j < chromaWidth; j++)
+		{
+			int sum[3] = { 0, 0, 0 };
+			int count = 0;
+			for (int y = 2 * i; y < std::min(2 * i + 2, yuv.height); y++)
+			{
+				for (int x = 2 * j; x < std::min(2 * j + 2, yuv.width); x++)
+				{
+					const unsigned char *pixel = rgb + (static_cast<size_t>(y) * yuv.width + x) * 3;
+					sum[0] += pixel[0];
+					sum[1] += pixel[1];
+					sum[2] += pixel[2];
+					count++;
+				}
+			}
+
+			int r = (sum[0] + count / 2) / count;
+			int g = (sum[1] + count / 2) / count;
+			int b = (sum[2] + count / 2) / count;
+			size_t index = static_cast<size_t>(i) * chromaWidth + j;
+			yuv.planes[1][index] = Clamp(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			yuv.planes[2][index] = Clamp(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+}
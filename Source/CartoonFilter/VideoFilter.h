@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <CartoonFilter\CpuPipeline.h>
+#include <CartoonFilter\SpscQueue.h>
+#include <CartoonFilter\Y4MFile.h>
+#include <CartoonFilter\YuvQuantizer.h>
+
+// Cartoon filter for Y4M video on the CPU. Decoding, filtering and encoding
+// run on their own threads, connected by bounded single producer, single
+// consumer queues, so the three overlap. The frames are allocated once and
+// go back to the decoder after they are written, so the memory used doesn't
+// depend on the length of the clip. The frames per second, the frames waiting
+// in each queue and the time of each stage are printed on stderr.
+// With the color levels the edges are found on the luma plane and the chroma
+// is quantized at its own resolution, the other colorings go through RGB.
+// The segmentation of each frame starts from the regions of the last one
+class VideoFilter
+{
+public:
+	// Frames waiting between two stages
+	static const int QUEUE_FRAMES = 4;
+
+	// Both queues full and a frame in each stage
+	static const int FRAME_COUNT = 2 * QUEUE_FRAMES + 3;
+
+public:
+	VideoFilter();
+
+public:
+	// Filters the input stream into the output, "-" is stdin or stdout.
+	// Returns false if a stream can't be read or written
+	bool Run(const std::string &input, const std::string &output, const CpuPipeline::Parameters &parameters);
+
+private:
+	// Decoded frame and its colors if they are needed, reused for the whole clip
+	struct Frame
+	{
+		YuvFrame yuv;
+		std::vector<unsigned char> rgb;
+	};
+
+	// Measured by each stage since the last report
+	struct StageStats
+	{
+		std::atomic<long long> busyMicroseconds;
+		std::atomic<long long> queuedFrames;
+		std::atomic<int> frames;
+	};
+
+	void Decode(Y4MReader &reader);
+	void Filter(const CpuPipeline::Parameters &parameters);
+	bool Encode(Y4MWriter &writer);
+
+	// Wait for room or for a frame, return false once the run is stopped.
+	// The queued frames seen by the consumer are added to its statistics
+	bool Push(SpscQueue<Frame*> &queue, Frame *frame);
+	bool Pop(SpscQueue<Frame*> &queue, Frame *&frame, StageStats *stats);
+
+	void Report(bool final);
+
+	// BT.601 video range, the chroma is shared by each 2x2 block
+	static void ToRgb(const YuvFrame &yuv, unsigned char *rgb);
+	static void ToYuv(const unsigned char *rgb, YuvFrame &yuv);
+
+private:
+	std::vector<Frame> frames;
+
+	// Written frames go back to the decoder, a null frame ends the stream
+	SpscQueue<Frame*> freeFrames;
+	SpscQueue<Frame*> decodedFrames;
+	SpscQueue<Frame*> filteredFrames;
+	std::atomic<bool> stop;
+
+	CpuPipeline pipeline;
+	YuvQuantizer quantizer;
+
+	StageStats decodeStats;
+	StageStats filterStats;
+	StageStats encodeStats;
+	int framesWritten;
+	std::chrono::steady_clock::time_point startTime;
+	std::chrono::steady_clock::time_point reportTime;
+	int reportFrames;
+};
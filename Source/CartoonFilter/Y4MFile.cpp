@@ -0,0 +1,220 @@
+#include "Y4MFile.h"
+
+#include <cstdlib>
+#include <sstream>
+
+#ifdef _WIN32
+	#include <io.h>
+	#include <fcntl.h>
+#endif
+
+namespace
+{
+	// Longest header line accepted, the frame headers are usually just FRAME
+	const size_t MAX_LINE = 4096;
+
+	// The standard streams are opened in text mode on Windows
+	void SetBinaryMode(FILE *file)
+	{
+	#ifdef _WIN32
+		_setmode(_fileno(file), _O_BINARY);
+	#else
+		(void)file;
+	#endif
+	}
+}
+
+void YuvFrame::Allocate(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	planes[0].resize(static_cast<size_t>(width) * height);
+	planes[1].resize(static_cast<size_t>(GetChromaWidth()) * GetChromaHeight());
+	planes[2].resize(planes[1].size());
+}
+
+int YuvFrame::GetChromaWidth() const
+{
+	return (width + 1) / 2;
+}
+
+int YuvFrame::GetChromaHeight() const
+{
+	return (height + 1) / 2;
+}
+
+Y4MReader::Y4MReader()
+{
+	file = nullptr;
+	ownsFile = false;
+	failed = false;
+	width = 0;
+	height = 0;
+}
+
+Y4MReader::~Y4MReader()
+{
+	if (ownsFile)
+		fclose(file);
+}
+
+bool Y4MReader::ReadLine(std::string &line)
+{
+	line.clear();
+	for (int c = fgetc(file); c != '\n'; c = fgetc(file))
+	{
+		if (c == EOF || line.size() == MAX_LINE)
+			return false;
+		line.push_back(static_cast<char>(c));
+	}
+	return true;
+}
+
+bool Y4MReader::Open(const std::string &fileName)
+{
+	if (fileName == "-")
+	{
+		file = stdin;
+		SetBinaryMode(file);
+	}
+	else
+	{
+		file = fopen(fileName.c_str(), "rb");
+		ownsFile = (file != nullptr);
+	}
+
+	if (!file || !ReadLine(header))
+		return false;
+
+	// Tags start with a letter, the chroma is 4:2:0 if there is no C tag.
+	// Only the 8 bit 4:2:0 sitings are read, not C420p10 or C420p12
+	std::istringstream tags(header);
+	std::string tag;
+	tags >> tag;
+	if (tag != "YUV4MPEG2")
+		return false;
+
+	while (tags >> tag)
+	{
+		if (tag[0] == 'W')
+			width = std::atoi(tag.c_str() + 1);
+		else if (tag[0] == 'H')
+			height = std::atoi(tag.c_str() + 1);
+		else if (tag[0] == 'C' && tag != "C420" && tag != "C420jpeg" && tag != "C420paldv" && tag != "C420mpeg2")
+			return false;
+	}
+
+	return width > 0 && height > 0;
+}
+
+bool Y4MReader::ReadFrame(YuvFrame &frame)
+{
+	if (!file || failed)
+		return false;
+
+	// The end of the stream is only valid before a frame header
+	std::string line;
+	if (!ReadLine(line))
+	{
+		failed = !line.empty() || ferror(file);
+		return false;
+	}
+
+	if (line.compare(0, 5, "FRAME") != 0)
+	{
+		failed = true;
+		return false;
+	}
+
+	frame.Allocate(width, height);
+	for (std::vector<unsigned char> &plane : frame.planes)
+	{
+		if (fread(plane.data(), 1, plane.size(), file) != plane.size())
+		{
+			failed = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Y4MReader::HasFailed() const
+{
+	return failed;
+}
+
+int Y4MReader::GetWidth() const
+{
+	return width;
+}
+
+int Y4MReader::GetHeight() const
+{
+	return height;
+}
+
+const std::string& Y4MReader::GetHeader() const
+{
+	return header;
+}
+
+Y4MWriter::Y4MWriter()
+{
+	file = nullptr;
+	ownsFile = false;
+	failed = false;
+}
+
+Y4MWriter::~Y4MWriter()
+{
+	Close();
+}
+
+bool Y4MWriter::Open(const std::string &fileName, const std::string &header)
+{
+	if (fileName == "-")
+	{
+		file = stdout;
+		SetBinaryMode(file);
+	}
+	else
+	{
+		file = fopen(fileName.c_str(), "wb");
+		ownsFile = (file != nullptr);
+	}
+
+	if (!file)
+		return false;
+
+	failed = fprintf(file, "%s\n", header.c_str()) < 0;
+	return !failed;
+}
+
+bool Y4MWriter::WriteFrame(const YuvFrame &frame)
+{
+	if (!file || failed)
+		return false;
+
+	failed = fputs("FRAME\n", file) < 0;
+	for (const std::vector<unsigned char> &plane : frame.planes)
+	{
+		if (!failed && fwrite(plane.data(), 1, plane.size(), file) != plane.size())
+			failed = true;
+	}
+	return !failed;
+}
+
+bool Y4MWriter::Close()
+{
+	if (!file)
+		return !failed;
+
+	if (fflush(file) != 0)
+		failed = true;
+	if (ownsFile && fclose(file) != 0)
+		failed = true;
+
+	file = nullptr;
+	ownsFile = false;
+	return !failed;
+}
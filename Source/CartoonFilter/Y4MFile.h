@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+// Frame with 4:2:0 chroma, the chroma planes have half the width and height rounded up
+struct YuvFrame
+{
+	std::vector<unsigned char> planes[3];
+	int width;
+	int height;
+
+	void Allocate(int width, int height);
+	int GetChromaWidth() const;
+	int GetChromaHeight() const;
+};
+
+// YUV4MPEG2 stream read a frame at a time from a file or from stdin ("-").
+// Only 4:2:0 streams with 8 bit samples are supported
+class Y4MReader
+{
+public:
+	Y4MReader();
+	~Y4MReader();
+
+public:
+	// Reads the stream header, returns false if it isn't a supported Y4M stream
+	bool Open(const std::string &fileName);
+
+	// Reads the next frame, returns false at the end of the stream or on an error
+	bool ReadFrame(YuvFrame &frame);
+
+	// True if the stream ended in the middle of a frame or a frame header is invalid
+	bool HasFailed() const;
+
+	int GetWidth() const;
+	int GetHeight() const;
+
+	// Header line without the newline, written as it is in the output
+	const std::string& GetHeader() const;
+
+private:
+	// Reads up to the newline, returns false at the end of the stream
+	bool ReadLine(std::string &line);
+
+private:
+	FILE *file;
+	bool ownsFile;
+	bool failed;
+	std::string header;
+	int width;
+	int height;
+};
+
+// YUV4MPEG2 stream written a frame at a time to a file or to stdout ("-")
+class Y4MWriter
+{
+public:
+	Y4MWriter();
+	~Y4MWriter();
+
+public:
+	// Writes the stream header, usually the one of the input
+	bool Open(const std::string &fileName, const std::string &header);
+
+	bool WriteFrame(const YuvFrame &frame);
+
+	// Returns false if any of the frames couldn't be written
+	bool Close();
+
+private:
+	FILE *file;
+	bool ownsFile;
+	bool failed;
+};
@@ -0,0 +1,81 @@
+#include "YuvQuantizer.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// Video range of the samples
+	const int LUMA_BLACK = 16;
+	const int LUMA_RANGE = 219;
+	const int CHROMA_GRAY = 128;
+	const int CHROMA_RANGE = 224;
+}
+
+YuvQuantizer::YuvQuantizer()
+{
+	levels = -1;
+	SetLevels(0);
+}
+
+void YuvQuantizer::SetLevels(int levels)
+{
+	levels = std::max(levels, 0);
+	if (this->levels == levels)
+		return;
+
+	this->levels = levels;
+	for (int value = 0; value < 256; value++)
+	{
+		// Same steps as the color levels, no levels gives black
+		float luma = std::min(std::max(static_cast<float>(value - LUMA_BLACK) / LUMA_RANGE, 0.0f), 1.0f);
+		float step = levels ? std::floor(luma * levels) / levels : 0.0f;
+		lumaTable[value] = static_cast<unsigned char>(LUMA_BLACK + std::floor(step * LUMA_RANGE + 0.5f));
+
+		// Rounded to the closest level on each side of gray
+		float size = levels ? static_cast<float>(CHROMA_RANGE) / levels : 0.0f;
+		float chroma = levels ? std::floor((value - CHROMA_GRAY) / size + 0.5f) * size : 0.0f;
+		chroma = std::min(std::max(chroma, -CHROMA_RANGE / 2.0f), CHROMA_RANGE / 2.0f);
+		chromaTable[value] = static_cast<unsigned char>(CHROMA_GRAY + std::floor(chroma + 0.5f));
+	}
+}
+
+void YuvQuantizer::Apply(YuvFrame &frame, const unsigned char *edges) const
+{
+	unsigned char *luma = frame.planes[0].data();
+	for (size_t i = 0; i < frame.planes[0].size(); i++)
+	{
+		luma[i] = edges[i] ? static_cast<unsigned char>(LUMA_BLACK) : lumaTable[luma[i]];
+	}
+
+	int chromaWidth = frame.GetChromaWidth();
+	int chromaHeight = frame.GetChromaHeight();
+	for (int i = 0; i < chromaHeight; i++)
+	{
+		int top = 2 * i;
+		int bottom = std::min(top + 2, frame.height);
+		for (int j = 0; j < chromaWidth; j++)
+		{
+			int left = 2 * j;
+			int right = std::min(left + 2, frame.width);
+
+			int count = 0;
+			int edgeCount = 0;
+			for (int y = top; y < bottom; y++)
+			{
+				for (int x = left; x < right; x++)
+				{
+					edgeCount += edges[static_cast<size_t>(y) * frame.width + x] ? 1 : 0;
+					count++;
+				}
+			}
+
+			size_t index = static_cast<size_t>(i) * chromaWidth + j;
+			for (int plane = 1; plane < 3; plane++)
+			{
+				int chroma = chromaTable[frame.planes[plane][index]] - CHROMA_GRAY;
+				frame.planes[plane][index] = static_cast<unsigned char>(CHROMA_GRAY + chroma * (count - edgeCount) / count);
+			}
+		}
+	}
+}
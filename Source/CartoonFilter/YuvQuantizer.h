@@ -0,0 +1,25 @@
+#pragma once
+
+#include <CartoonFilter\Y4MFile.h>
+
+// Color levels of a video frame applied to each plane at its own resolution,
+// without going through RGB. The luma is quantized like the color channels
+// of Cartoon.FS.glsl over the video range, and is black on the edges. The
+// chroma is quantized around gray, so gray stays gray, and fades to gray
+// with the share of edge pixels in its 2x2 block
+class YuvQuantizer
+{
+public:
+	YuvQuantizer();
+
+public:
+	void SetLevels(int levels);
+
+	// The edge mask has one byte for each luma sample, 255 on the edges
+	void Apply(YuvFrame &frame, const unsigned char *edges) const;
+
+private:
+	int levels;
+	unsigned char lumaTable[256];
+	unsigned char chromaTable[256];
+};
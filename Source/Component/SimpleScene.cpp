@@ -63,7 +63,6 @@ void SimpleScene::InitResources()
 		Shader *shader = new Shader("Simple");
 		shader->AddShader(RESOURCE_PATH::SHADERS + "MVP.Texture.VS.glsl", GL_VERTEX_SHADER);
 		shader->AddShader(RESOURCE_PATH::SHADERS + "Default.FS.glsl", GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
@@ -72,7 +71,6 @@ void SimpleScene::InitResources()
 		Shader *shader = new Shader("Color");
 		shader->AddShader(RESOURCE_PATH::SHADERS + "MVP.Texture.VS.glsl", GL_VERTEX_SHADER);
 		shader->AddShader(RESOURCE_PATH::SHADERS + "Color.FS.glsl", GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
@@ -81,7 +79,6 @@ void SimpleScene::InitResources()
 		Shader *shader = new Shader("VertexNormal");
 		shader->AddShader(RESOURCE_PATH::SHADERS + "MVP.Texture.VS.glsl", GL_VERTEX_SHADER);
 		shader->AddShader(RESOURCE_PATH::SHADERS + "Normals.FS.glsl", GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
@@ -90,10 +87,12 @@ void SimpleScene::InitResources()
 		Shader *shader = new Shader("VertexColor");
 		shader->AddShader(RESOURCE_PATH::SHADERS + "MVP.Texture.VS.glsl", GL_VERTEX_SHADER);
 		shader->AddShader(RESOURCE_PATH::SHADERS + "VertexColor.FS.glsl", GL_FRAGMENT_SHADER);
-		shader->CreateAndLink();
 		shaders[shader->GetName()] = shader;
 	}
 
+	// Compile the programs concurrently when the driver allows it
+	Shader::CreateAndLinkAll({ shaders["Simple"], shaders["Color"], shaders["VertexNormal"], shaders["VertexColor"] });
+
 	// Default rendering mode will use depth buffer
 	glDepthMask(GL_TRUE);
 	glEnable(GL_DEPTH_TEST);
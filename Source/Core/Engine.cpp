@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include <include/gl.h>
+#include <Core/GPU/PixelBufferRing.h>
 
 using namespace std;
 
@@ -42,6 +43,10 @@ void Engine::Exit()
 {
 	cout << "=====================================================" << endl;
 	cout << "Engine closed. Exit" << endl;
+
+	// Images still being saved are written before the context is gone
+	ImageExporter::Shutdown();
+	PixelBufferRing::ReleaseShared();
 	glfwTerminate();
 }
 
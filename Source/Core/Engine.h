@@ -13,8 +13,12 @@
 #include <Core/GPU/Mesh.h>
 #include <Core/GPU/Shader.h>
 #include <Core/GPU/FrameBuffer.h>
+#include <Core/GPU/RenderTargetPool.h>
 #include <Core/GPU/Texture2D.h>
+#include <Core/GPU/TextureArray.h>
+#include <Core/GPU/Texture3D.h>
 #include <Core/GPU/SSBO.h>
+#include <Core/GPU/UBO.h>
 #include <Core/GPU/ParticleEffect.h>
 
 #include <Core/World.h>
@@ -23,6 +27,7 @@
 
 #include <Core/Managers/ResourcePath.h>
 #include <Core/Managers/TextureManager.h>
+#include <Core/Managers/ImageExporter.h>
 
 #include <Core/Window/WindowObject.h>
 #include <Core/Window/InputController.h>
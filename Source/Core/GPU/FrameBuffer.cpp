@@ -16,9 +16,11 @@ glm::vec4 FrameBuffer::defaultClearColor = glm::vec4(0);
 FrameBuffer::FrameBuffer()
 {
 	FBO = 0; 
+	nrTextures = 0;
 	depthTexture = nullptr;
 	textures = nullptr;
 	DrawBuffers = nullptr;
+	mipmapped = false;
 	clearColor = glm::vec4(0, 0, 0, 1);
 }
 
@@ -31,6 +33,14 @@ void FrameBuffer::Clean()
 {
 	if (FBO)
 		glDeleteFramebuffers(1, &FBO);
+	FBO = 0;
+
+	// Texture2D doesn't release the GL texture, the attachments are freed here
+	for (unsigned int i = 0; textures && i < nrTextures; i++)
+	{
+		GLuint textureID = textures[i].GetTextureID();
+		glDeleteTextures(1, &textureID);
+	}
 	SAFE_FREE_ARRAY(textures);
 	SAFE_FREE_ARRAY(DrawBuffers)
 }
@@ -48,6 +58,7 @@ void FrameBuffer::Generate(int width, int height, int nrTextures, bool hasDepthT
 	this->width = width;
 	this->height = height;
 	this->nrTextures = nrTextures;
+	this->formats.clear();
 
 	// Create FrameBufferObject
 	glGenFramebuffers (1, &FBO);
@@ -84,6 +95,54 @@ void FrameBuffer::Generate(int width, int height, int nrTextures, bool hasDepthT
 	CheckOpenGLError();
 }
 
+void FrameBuffer::GenerateWithFormats(int width, int height, const std::vector<unsigned int> &formats, bool hasDepthTexture, bool mipmapped)
+{
+	Clean();
+
+	#ifdef DEBUG_INFO
+		cout << "FBO: " << width << " * " << height << " textures attached: " << formats.size() << endl;
+	#endif
+
+	this->width = width;
+	this->height = height;
+	this->nrTextures = static_cast<unsigned int>(formats.size());
+	this->formats = formats;
+	this->mipmapped = mipmapped;
+
+	// Create FrameBufferObject
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+	if (nrTextures > 0) {
+		DrawBuffers = new GLenum[nrTextures];
+
+		// Add attachments to drawing buffer
+		for (unsigned int i = 0; i < nrTextures; i++)
+			DrawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+
+		// Create attached textures with the requested formats
+		textures = new Texture2D[nrTextures];
+		for (unsigned int i = 0; i < nrTextures; i++)
+		{
+			textures[i].CreateColorAttachment(width, height, i, static_cast<GLenum>(formats[i]), GetMipLevels());
+		}
+
+		glDrawBuffers(nrTextures, DrawBuffers);
+	}
+
+	// Post-processing passes usually don't need a depth texture
+	if (hasDepthTexture) {
+		depthTexture = new Texture2D();
+		depthTexture->CreateDepthBufferTexture(width, height);
+	}
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		cout << "FRAMEBUFFER NOT COMPLETE" << endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CheckOpenGLError();
+}
+
 void FrameBuffer::Resize(int width, int height, int precision)
 {
 	this->width = width;
@@ -94,7 +153,10 @@ void FrameBuffer::Resize(int width, int height, int precision)
 
 	for (unsigned int i = 0; i < nrTextures; i++)
 	{
-		textures[i].CreateFrameBufferTexture(width, height, i, precision);
+		if (formats.empty())
+			textures[i].CreateFrameBufferTexture(width, height, i, precision);
+		else
+			textures[i].CreateColorAttachment(width, height, i, static_cast<GLenum>(formats[i]), GetMipLevels());
 	}
 
 	if (depthTexture) {
@@ -102,6 +164,11 @@ void FrameBuffer::Resize(int width, int height, int precision)
 	}
 }
 
+unsigned int FrameBuffer::GetMipLevels() const
+{
+	return mipmapped ? Texture2D::GetMipLevelCount(width, height) : 1;
+}
+
 void FrameBuffer::Bind(bool clearBuffer) const
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
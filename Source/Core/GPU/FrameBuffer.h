@@ -13,6 +13,12 @@ class FrameBuffer
 		~FrameBuffer();
 		void Clean();
 		void Generate(int width, int height, int nrTextures, bool hasDepthTexture = true, int precision = 32);
+		// One color attachment is created for each internal format (GL_R8, GL_RG16F, ...).
+		// Mipmapped attachments get storage for the full chain of levels. Not an overload
+		// of Generate, a braced list of one format would convert to nrTextures
+		void GenerateWithFormats(int width, int height, const std::vector<unsigned int> &formats, bool hasDepthTexture = false, bool mipmapped = false);
+
+		// Attachments are only reallocated if the size changed
 		void Resize(int width, int height, int precision = 32);
 
 		void Bind(bool clearBuffer = true) const;
@@ -36,6 +42,9 @@ class FrameBuffer
 		static void SetViewport(const glm::ivec2 &viewportSize, const glm::ivec2 offset = glm::ivec2(0, 0));
 		static void SetDefaultClearColor(glm::vec4 clearColor);
 
+	private:
+		unsigned int GetMipLevels() const;
+
 	private:
 		Texture2D *textures;
 		Texture2D *depthTexture;
@@ -47,6 +56,8 @@ class FrameBuffer
 		int width;
 		int height;
 		unsigned int nrTextures;
+		std::vector<unsigned int> formats;
+		bool mipmapped;
 		glm::vec4 clearColor;
 		static glm::vec4 defaultClearColor;
 };
\ No newline at end of file
@@ -276,3 +276,15 @@ void Mesh::Render() const
 	}
 	glBindVertexArray(0);
 }
+
+void Mesh::RenderInstanced(unsigned int instances) const
+{
+	glBindVertexArray(buffers->VAO);
+	for (unsigned int i = 0; i < meshEntries.size(); i++)
+	{
+		glDrawElementsInstancedBaseVertex(glDrawMode, meshEntries[i].nrIndices,
+			GL_UNSIGNED_SHORT, (void*)(sizeof(unsigned short) * meshEntries[i].baseIndex),
+			instances, meshEntries[i].baseVertex);
+	}
+	glBindVertexArray(0);
+}
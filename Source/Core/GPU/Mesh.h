@@ -104,6 +104,9 @@ class Mesh
 
 		void Render() const;
 
+		// Draws the mesh several times, the shaders tell the copies apart with gl_InstanceID
+		void RenderInstanced(unsigned int instances) const;
+
 		const GPUBuffers* GetBuffers() const;
 		const char* GetMeshID() const;
 
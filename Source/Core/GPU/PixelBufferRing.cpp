@@ -0,0 +1,128 @@
+#include "PixelBufferRing.h"
+
+#include <memory>
+
+using namespace std;
+
+namespace
+{
+	unique_ptr<PixelBufferRing> sharedRing;
+}
+
+PixelBufferRing::PixelBufferRing(unsigned int count)
+{
+	current = 0;
+	persistent = GLEW_ARB_buffer_storage ? true : false;
+	slots.resize(count > 0 ? count : 1);
+	for (auto &slot : slots)
+	{
+		slot.buffer = 0;
+		slot.fence = nullptr;
+		slot.mapping = nullptr;
+		slot.capacity = 0;
+	}
+}
+
+PixelBufferRing::~PixelBufferRing()
+{
+	for (auto &slot : slots)
+		Release(slot);
+}
+
+PixelBufferRing* PixelBufferRing::GetShared()
+{
+	if (!sharedRing)
+		sharedRing = unique_ptr<PixelBufferRing>(new PixelBufferRing());
+	return sharedRing.get();
+}
+
+void PixelBufferRing::ReleaseShared()
+{
+	sharedRing.reset();
+}
+
+void* PixelBufferRing::Map(size_t size)
+{
+	Slot &slot = slots[current];
+
+	// Only stalls when all the buffers of the ring are still in flight
+	if (slot.fence)
+	{
+		glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+	}
+
+	if (size > slot.capacity)
+		Allocate(slot, size);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+	// Orphan the old storage, the driver doesn't have to synchronize with it
+	void *mapping = persistent ? slot.mapping :
+		glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	// The caller falls back to uploading from client memory
+	if (mapping == nullptr)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return mapping;
+}
+
+void PixelBufferRing::Submit()
+{
+	Slot &slot = slots[current];
+
+	if (!persistent)
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	current = (current + 1) % slots.size();
+}
+
+void PixelBufferRing::Allocate(Slot &slot, size_t size)
+{
+	Release(slot);
+	slot.capacity = size;
+
+	glGenBuffers(1, &slot.buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+	if (persistent)
+	{
+		// Coherent mapping, writes are visible to the GPU without flushing
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+		slot.mapping = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+	}
+	else
+	{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	CheckOpenGLError();
+}
+
+void PixelBufferRing::Release(Slot &slot)
+{
+	if (slot.fence)
+		glDeleteSync(slot.fence);
+
+	if (slot.mapping)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	if (slot.buffer)
+		glDeleteBuffers(1, &slot.buffer);
+
+	slot.buffer = 0;
+	slot.fence = nullptr;
+	slot.mapping = nullptr;
+	slot.capacity = 0;
+}
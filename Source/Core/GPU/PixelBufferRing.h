@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+
+#include <include/gl.h>
+
+// Ring of pixel unpack buffers used to stream texture data. While the GPU
+// copies from one buffer the CPU can already fill the next one. Buffers are
+// mapped once for their whole lifetime when ARB_buffer_storage is available.
+// All the textures stream through one shared ring, each buffer grows to the
+// largest upload made through it
+class PixelBufferRing
+{
+	public:
+		PixelBufferRing(unsigned int count = 3);
+		~PixelBufferRing();
+
+		// The ring used by all the textures, created on first use
+		static PixelBufferRing* GetShared();
+
+		// Frees the buffers of the shared ring, before the context is destroyed
+		static void ReleaseShared();
+
+		// Returns memory for the next upload, waiting only if the GPU
+		// still reads from the buffer. The buffer is bound when returned
+		void* Map(size_t size);
+
+		// Unbinds the buffer after the texture commands were issued and
+		// fences it so it isn't overwritten before the copy is done
+		void Submit();
+
+	private:
+		struct Slot
+		{
+			GLuint buffer;
+			GLsync fence;
+			void *mapping;
+			size_t capacity;
+		};
+
+		void Allocate(Slot &slot, size_t size);
+		void Release(Slot &slot);
+
+	private:
+		bool persistent;
+		unsigned int current;
+		std::vector<Slot> slots;
+};
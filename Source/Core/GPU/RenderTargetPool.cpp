@@ -0,0 +1,91 @@
+#include "RenderTargetPool.h"
+
+#include <Core/GPU/FrameBuffer.h>
+#include <Core/GPU/Texture2D.h>
+
+RenderTargetPool::RenderTargetPool()
+{
+	allocationCount = 0;
+	residentMemory = 0;
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+	for (auto &target : targets)
+	{
+		target.frameBuffer->Clean();
+		delete target.frameBuffer;
+	}
+}
+
+FrameBuffer* RenderTargetPool::Acquire(const glm::ivec2 &resolution, GLenum format)
+{
+	for (auto &target : targets)
+	{
+		if (!target.inUse && target.format == format && target.resolution == resolution)
+		{
+			target.inUse = true;
+			target.acquired = true;
+			return target.frameBuffer;
+		}
+	}
+
+	Target target;
+	target.frameBuffer = new FrameBuffer();
+	target.frameBuffer->GenerateWithFormats(resolution.x, resolution.y, { format });
+	target.resolution = resolution;
+	target.format = format;
+	target.memorySize = (size_t)resolution.x * resolution.y * Texture2D::GetBytesPerPixel(format);
+	target.inUse = true;
+	target.acquired = true;
+	targets.push_back(target);
+
+	allocationCount++;
+	residentMemory += target.memorySize;
+	return target.frameBuffer;
+}
+
+void RenderTargetPool::Release(FrameBuffer *frameBuffer)
+{
+	for (auto &target : targets)
+	{
+		if (target.frameBuffer == frameBuffer)
+		{
+			target.inUse = false;
+			return;
+		}
+	}
+}
+
+void RenderTargetPool::Trim()
+{
+	for (auto it = targets.begin(); it != targets.end(); )
+	{
+		if (!it->inUse && !it->acquired)
+		{
+			residentMemory -= it->memorySize;
+			it->frameBuffer->Clean();
+			delete it->frameBuffer;
+			it = targets.erase(it);
+			continue;
+		}
+
+		it->acquired = false;
+		++it;
+	}
+}
+
+unsigned int RenderTargetPool::GetAllocationCount() const
+{
+	return allocationCount;
+}
+
+unsigned int RenderTargetPool::GetTargetCount() const
+{
+	return static_cast<unsigned int>(targets.size());
+}
+
+size_t RenderTargetPool::GetResidentMemory() const
+{
+	return residentMemory;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+
+#include <include/gl.h>
+#include <include/glm.h>
+
+class FrameBuffer;
+
+// Transient render targets shared by the passes. A target released by a
+// pass is handed to the next pass that asks for the same size and format,
+// so intermediate results whose lifetimes don't overlap use the same memory
+class RenderTargetPool
+{
+	public:
+		RenderTargetPool();
+		~RenderTargetPool();
+
+		// Returns a frame buffer with a single color attachment
+		FrameBuffer* Acquire(const glm::ivec2 &resolution, GLenum format);
+		void Release(FrameBuffer *target);
+
+		// Frees the targets that were not acquired since the previous call
+		void Trim();
+
+		// Frame buffers created since the pool was created
+		unsigned int GetAllocationCount() const;
+		unsigned int GetTargetCount() const;
+
+		// Bytes of video memory held by the attachments of the pooled targets
+		size_t GetResidentMemory() const;
+
+	private:
+		struct Target
+		{
+			FrameBuffer *frameBuffer;
+			glm::ivec2 resolution;
+			GLenum format;
+			size_t memorySize;
+			bool inUse;
+			bool acquired;
+		};
+
+		std::vector<Target> targets;
+		unsigned int allocationCount;
+		size_t residentMemory;
+};
@@ -2,19 +2,30 @@
 
 #include <fstream>
 #include <iostream>
+#include <cstring>
 #include <include/gl.h>
+#include <Core/Managers/ResourcePath.h>
+
+#ifdef _WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
 
 using namespace std;
 
 Shader::Shader(const char * name)
 {
 	program = 0;
+	sourceHash = 0;
+	loadedFromCache = false;
 	shaderName = string(name);
 	shaderFiles.reserve(5);
 }
 
 Shader::~Shader()
 {
+	ClearVariants();
 	glDeleteProgram(program);
 }
 
@@ -44,6 +55,9 @@ unsigned int Shader::Reload()
 		program = 0;
 	}
 
+	// Variants are compiled again from the new sources when requested
+	ClearVariants();
+
 	return CreateAndLink();
 }
 
@@ -57,7 +71,162 @@ void Shader::BindTexturesUnits()
 
 GLint Shader::GetUniformLocation(const char *uniformName) const
 {
-	return glGetUniformLocation(program, uniformName);
+	auto uniform = uniforms.find(uniformName);
+	if (uniform != uniforms.end())
+		return uniform->second.location;
+
+	// Only array elements have to be queried, the rest are all reflected
+	if (program && strchr(uniformName, '['))
+		return glGetUniformLocation(program, uniformName);
+
+	return INVALID_LOC;
+}
+
+Shader::Uniform* Shader::GetChangedUniform(const char *uniformName, const void *value, size_t size)
+{
+	auto uniform = uniforms.find(uniformName);
+	if (uniform == uniforms.end())
+		return nullptr;
+
+	Uniform &u = uniform->second;
+	if (u.hasValue && memcmp(u.value, value, size) == 0)
+		return nullptr;
+
+	u.hasValue = true;
+	memcpy(u.value, value, size);
+	return &u;
+}
+
+void Shader::SetUniform(const char *uniformName, int value)
+{
+	Uniform *u = GetChangedUniform(uniformName, &value, sizeof(value));
+	if (u)
+		glUniform1i(u->location, value);
+}
+
+void Shader::SetUniform(const char *uniformName, float value)
+{
+	Uniform *u = GetChangedUniform(uniformName, &value, sizeof(value));
+	if (u)
+		glUniform1f(u->location, value);
+}
+
+void Shader::SetUniform(const char *uniformName, const glm::ivec2 &value)
+{
+	Uniform *u = GetChangedUniform(uniformName, glm::value_ptr(value), sizeof(value));
+	if (u)
+		glUniform2i(u->location, value.x, value.y);
+}
+
+void Shader::SetUniform(const char *uniformName, const glm::vec2 &value)
+{
+	Uniform *u = GetChangedUniform(uniformName, glm::value_ptr(value), sizeof(value));
+	if (u)
+		glUniform2f(u->location, value.x, value.y);
+}
+
+void Shader::SetUniform(const char *uniformName, const glm::vec3 &value)
+{
+	Uniform *u = GetChangedUniform(uniformName, glm::value_ptr(value), sizeof(value));
+	if (u)
+		glUniform3f(u->location, value.x, value.y, value.z);
+}
+
+void Shader::SetUniform(const char *uniformName, const glm::vec4 &value)
+{
+	Uniform *u = GetChangedUniform(uniformName, glm::value_ptr(value), sizeof(value));
+	if (u)
+		glUniform4f(u->location, value.x, value.y, value.z, value.w);
+}
+
+void Shader::BindUniformBlock(const char *blockName, GLuint bindingPoint)
+{
+	uniformBlocks[blockName] = bindingPoint;
+	if (program)
+		BindUniformBlocks();
+}
+
+void Shader::BindUniformBlocks() const
+{
+	for (auto &block : uniformBlocks)
+	{
+		GLuint blockIndex = glGetUniformBlockIndex(program, block.first.c_str());
+		if (blockIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, blockIndex, block.second);
+	}
+}
+
+void Shader::SetDefine(const string &name, const string &value)
+{
+	defines[name] = value;
+}
+
+Shader* Shader::GetVariant(const map<string, int> &variantDefines)
+{
+	// The definitions are sorted by name so the key is the same for any order
+	string key;
+	for (auto &define : variantDefines)
+		key += "." + define.first + "_" + to_string(define.second);
+
+	auto variant = variants.find(key);
+	if (variant != variants.end())
+		return variant->second;
+
+	// The name is also used for the binary cache file of the variant
+	Shader *shader = new Shader((shaderName + key).c_str());
+	for (auto &S : shaderFiles)
+		shader->AddShader(S.file, S.type);
+
+	shader->defines = defines;
+	for (auto &define : variantDefines)
+		shader->SetDefine(define.first, to_string(define.second));
+
+	shader->uniformBlocks = uniformBlocks;
+	shader->CreateAndLink();
+
+	variants[key] = shader;
+	return shader;
+}
+
+void Shader::ClearVariants()
+{
+	for (auto &variant : variants)
+		delete variant.second;
+	variants.clear();
+}
+
+void Shader::ReflectUniforms()
+{
+	uniforms.clear();
+
+	GLint count = 0;
+	GLint maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	vector<char> name(maxLength + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		Uniform uniform;
+		GLsizei length = 0;
+		glGetActiveUniform(program, i, maxLength, &length, &uniform.size, &uniform.type, &name[0]);
+
+		// Members of uniform blocks don't have a location
+		uniform.location = glGetUniformLocation(program, &name[0]);
+		if (uniform.location == INVALID_LOC)
+			continue;
+
+		// Arrays are reported as "name[0]", the elements of arrays of
+		// structs have their own members, such as "lights[1].color"
+		string uniformName(&name[0], length);
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			uniformName.resize(uniformName.size() - 3);
+
+		uniform.hasValue = false;
+		uniforms[uniformName] = uniform;
+	}
+
+	CheckOpenGLError();
 }
 
 void Shader::OnLoad(function<void()> onLoad)
@@ -113,34 +282,107 @@ void Shader::AddShader(const string & shaderFile, GLenum shaderType)
 
 unsigned int Shader::CreateAndLink()
 {
-	vector<unsigned int> shaders;
+	BeginCreateAndLink();
+	return FinishCreateAndLink();
+}
+
+void Shader::CreateAndLinkAll(const vector<Shader*> &shaders)
+{
+	EnableParallelCompile();
 
-	// Compile shaders
-	for (auto S : shaderFiles) {
-		auto shaderID = Shader::CreateShader(S.file, S.type);
-		if (shaderID) {
-			shaders.push_back(shaderID);
+	// Submit all the programs before waiting for any of them,
+	// so that the driver can compile them concurrently
+	for (auto shader : shaders)
+		shader->BeginCreateAndLink();
+
+	for (auto shader : shaders)
+		shader->FinishCreateAndLink();
+}
+
+void Shader::EnableParallelCompile()
+{
+	static bool enabled = false;
+	if (enabled)
+		return;
+	enabled = true;
+
+	typedef void (APIENTRY *MaxShaderCompilerThreadsFunc)(GLuint count);
+	MaxShaderCompilerThreadsFunc maxShaderCompilerThreads = nullptr;
+
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+		maxShaderCompilerThreads = (MaxShaderCompilerThreadsFunc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+		maxShaderCompilerThreads = (MaxShaderCompilerThreadsFunc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+
+	// Let the driver pick the number of threads
+	if (maxShaderCompilerThreads)
+		maxShaderCompilerThreads(0xFFFFFFFF);
+}
+
+void Shader::BeginCreateAndLink()
+{
+	pendingShaders.clear();
+	loadedFromCache = false;
+
+	// Read the sources, they are needed for the cache key
+	for (auto &S : shaderFiles) {
+		S.code = InjectDefines(ReadShaderFile(S.file));
+	}
+	sourceHash = ComputeSourceHash();
+
+	if (LoadProgramBinary()) {
+		loadedFromCache = true;
+		return;
+	}
+
+	// Only submit the work, the results are checked when finishing
+	for (auto &S : shaderFiles) {
+		pendingShaders.push_back(Shader::CreateShader(S.code, S.type));
+	}
+
+	program = Shader::CreateProgram(pendingShaders);
+}
+
+unsigned int Shader::FinishCreateAndLink()
+{
+	if (!loadedFromCache)
+	{
+		cout << "\tPROGRAM = " << shaderName;
+
+		bool compiled = true;
+		for (size_t i = 0; i < pendingShaders.size(); i++) {
+			compiled = Shader::CheckShader(pendingShaders[i], shaderFiles[i].file, shaderFiles[i].type) && compiled;
 		}
-		else {
+
+		bool linked = compiled && program && Shader::CheckProgram(program);
+
+		// Delete the shader objects because we do not need them any more
+		for (auto shader : pendingShaders)
+			glDeleteShader(shader);
+		pendingShaders.clear();
+
+		if (!linked) {
+			glDeleteProgram(program);
+			program = 0;
 			return 0;
 		}
-	}
 
-	// Create Program and Link
-	if (shaders.size()) {
-		program = Shader::CreateProgram(shaders);
+		cout << "\t ..... COMPILED " << endl;
+		SaveProgramBinary();
+	}
+	else
+	{
+		cout << "\tPROGRAM = " << shaderName << "\t ..... LOADED FROM CACHE " << endl;
+	}
 
-		if (program)
-		{
-			glUseProgram(program);
-			GetUniforms();
-			for (auto Observer : loadObservers) {
-				Observer();
-			}
-			return program;
-		}
+	glUseProgram(program);
+	BindUniformBlocks();
+	ReflectUniforms();
+	GetUniforms();
+	for (auto Observer : loadObservers) {
+		Observer();
 	}
-	return 0;
+	return program;
 }
 
 void Shader::ClearShaders()
@@ -148,7 +390,7 @@ void Shader::ClearShaders()
 	shaderFiles.clear();
 }
 
-unsigned int Shader::CreateShader(const string &shaderFile, GLenum shaderType)
+string Shader::ReadShaderFile(const string &shaderFile)
 {
 	string shader_code;
 	ifstream file(shaderFile.c_str(), ios::in);
@@ -158,8 +400,6 @@ unsigned int Shader::CreateShader(const string &shaderFile, GLenum shaderType)
 		terminate();
 	}
 
-	cout << "\tFILE = " << shaderFile;
-
 	// Get file content
 	file.seekg(0, ios::end);
 	shader_code.resize((unsigned int)file.tellg());
@@ -167,22 +407,59 @@ unsigned int Shader::CreateShader(const string &shaderFile, GLenum shaderType)
 	file.read(&shader_code[0], shader_code.size());
 	file.close();
 
-	int infoLogLength = 0;
-	int compileResult = 0;
-	unsigned int glShaderObject;
+	return shader_code;
+}
+
+string Shader::InjectDefines(const string &shaderCode) const
+{
+	if (defines.empty())
+		return shaderCode;
+
+	string defineCode;
+	for (auto &define : defines)
+		defineCode += "#define " + define.first + " " + define.second + "\n";
+
+	// The #version directive must stay the first statement of the source
+	size_t insertAt = 0;
+	size_t version = shaderCode.find("#version");
+	if (version != string::npos)
+	{
+		size_t lineEnd = shaderCode.find('\n', version);
+		insertAt = (lineEnd == string::npos) ? shaderCode.size() : lineEnd + 1;
+		if (lineEnd == string::npos)
+			defineCode = "\n" + defineCode;
+	}
 
+	return shaderCode.substr(0, insertAt) + defineCode + shaderCode.substr(insertAt);
+}
+
+unsigned int Shader::CreateShader(const string &shaderCode, GLenum shaderType)
+{
 	// Create new shader object
-	glShaderObject = glCreateShader(shaderType);
+	unsigned int glShaderObject = glCreateShader(shaderType);
 	if (glShaderObject == 0) {
-		cout << "\t ..... ERROR " << endl;
 		return 0;
 	}
 
-	const char *shader_code_ptr = shader_code.c_str();
-	const int shader_code_size = (int) shader_code.size();
+	const char *shader_code_ptr = shaderCode.c_str();
+	const int shader_code_size = (int) shaderCode.size();
 
 	glShaderSource(glShaderObject, 1, &shader_code_ptr, &shader_code_size);
 	glCompileShader(glShaderObject);
+
+	return glShaderObject;
+}
+
+bool Shader::CheckShader(unsigned int glShaderObject, const string &shaderFile, GLenum shaderType)
+{
+	int infoLogLength = 0;
+	int compileResult = 0;
+
+	if (glShaderObject == 0) {
+		cout << "\n\tFILE = " << shaderFile << "\t ..... ERROR " << endl;
+		return false;
+	}
+
 	glGetShaderiv(glShaderObject, GL_COMPILE_STATUS, &compileResult);
 
 	// LOG COMPILE ERRORS
@@ -204,30 +481,38 @@ unsigned int Shader::CreateShader(const string &shaderFile, GLenum shaderType)
 		glGetShaderInfoLog(glShaderObject, infoLogLength, NULL, &shader_log[0]);
 
 		cout << "\n-----------------------------------------------------\n";
-		cout << "\n[ERROR]: [" << str_shader_type << " SHADER]\n\n";
+		cout << "\n[ERROR]: [" << str_shader_type << " SHADER] " << shaderFile << "\n\n";
 		cout << &shader_log[0] << "\n";
 		cout << "-----------------------------------------------------" << endl;
 
-		return 0;
+		return false;
 	}
 
-	cout << "\t ..... COMPILED " << endl;
-
-	return glShaderObject;
+	return true;
 }
 
 unsigned int Shader::CreateProgram(const vector<unsigned int> &shaderObjects)
 {
-	int infoLogLength = 0;
-	int linkResult = 0;
-
 	// build OpenGL program object and link all the OpenGL shader objects
 	unsigned int glProgramObject = glCreateProgram();
 
 	for (auto shader: shaderObjects)
 		glAttachShader(glProgramObject, shader);
 
+	// Allow the binary to be stored in the program cache
+	if (GLEW_ARB_get_program_binary)
+		glProgramParameteri(glProgramObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	glLinkProgram(glProgramObject);
+
+	return glProgramObject;
+}
+
+bool Shader::CheckProgram(unsigned int glProgramObject)
+{
+	int infoLogLength = 0;
+	int linkResult = 0;
+
 	glGetProgramiv(glProgramObject, GL_LINK_STATUS, &linkResult);
 
 	// LOG LINK ERRORS
@@ -240,14 +525,118 @@ unsigned int Shader::CreateProgram(const vector<unsigned int> &shaderObjects)
 		cout << "Shader Loader : LINK ERROR" << endl;
 		cout << &program_log[0] << endl;
 
-		return 0;
+		return false;
 	}
 
-	// Delete the shader objects because we do not need them any more
-	for (auto shader: shaderObjects)
-		glDeleteShader(shader);
+	CheckOpenGLError();
+	return true;
+}
 
-	return glProgramObject;
+unsigned long long Shader::ComputeSourceHash() const
+{
+	// FNV-1a over the sources and the driver identification, so that
+	// a driver update or an edited file invalidates the cached binary
+	unsigned long long hash = 14695981039346656037ULL;
+	auto hashBytes = [&hash](const void *data, size_t size) {
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+
+	for (auto &S : shaderFiles) {
+		hashBytes(&S.type, sizeof(S.type));
+		hashBytes(S.code.c_str(), S.code.size());
+	}
+
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		const char *value = reinterpret_cast<const char*>(glGetString(name));
+		if (value)
+			hashBytes(value, strlen(value));
+	}
+
+	return hash;
+}
+
+string Shader::GetBinaryCacheFile() const
+{
+	return RESOURCE_PATH::SHADER_CACHE + shaderName + ".bin";
+}
+
+bool Shader::LoadProgramBinary()
+{
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+
+	ifstream file(GetBinaryCacheFile().c_str(), ios::in | ios::binary);
+	if (!file.good())
+		return false;
+
+	// Header: source hash, binary format and binary size
+	unsigned long long hash = 0;
+	GLenum binaryFormat = 0;
+	GLint length = 0;
+	file.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+	file.read(reinterpret_cast<char*>(&binaryFormat), sizeof(binaryFormat));
+	file.read(reinterpret_cast<char*>(&length), sizeof(length));
+
+	if (!file.good() || hash != sourceHash || length <= 0)
+		return false;
+
+	vector<char> binary(length);
+	file.read(&binary[0], length);
+	if (!file.good())
+		return false;
+
+	program = glCreateProgram();
+	glProgramBinary(program, binaryFormat, &binary[0], length);
+
+	// The driver may still reject the binary, fall back to compiling
+	GLint linkResult = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkResult);
+	if (linkResult == GL_FALSE) {
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+
+	return true;
+}
+
+void Shader::SaveProgramBinary() const
+{
+	if (!GLEW_ARB_get_program_binary)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	vector<char> binary(length);
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(program, length, NULL, &binaryFormat, &binary[0]);
+
+	MakeDirectory(RESOURCE_PATH::SHADER_CACHE);
+
+	ofstream file(GetBinaryCacheFile().c_str(), ios::out | ios::binary | ios::trunc);
+	if (!file.good())
+		return;
+
+	file.write(reinterpret_cast<const char*>(&sourceHash), sizeof(sourceHash));
+	file.write(reinterpret_cast<const char*>(&binaryFormat), sizeof(binaryFormat));
+	file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	file.write(&binary[0], length);
 
 	CheckOpenGLError();
-}
\ No newline at end of file
+}
+
+void Shader::MakeDirectory(const string &path)
+{
+	#ifdef _WIN32
+		_mkdir(path.c_str());
+	#else
+		mkdir(path.c_str(), 0755);
+	#endif
+}
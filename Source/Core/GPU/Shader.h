@@ -2,9 +2,12 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <functional>
+#include <unordered_map>
 
 #include <include/gl.h>
+#include <include/glm.h>
 
 #define MAX_2D_TEXTURES		16
 #define INVALID_LOC			-1
@@ -25,15 +28,62 @@ class Shader
 		void ClearShaders();
 		unsigned int CreateAndLink();
 
+		// Compiling is split in two steps so that several programs can be
+		// submitted to the driver before waiting on any of them. Programs
+		// are loaded from the binary cache when the sources didn't change
+		void BeginCreateAndLink();
+		unsigned int FinishCreateAndLink();
+		static void CreateAndLinkAll(const std::vector<Shader*> &shaders);
+
 		void BindTexturesUnits();
 		GLint GetUniformLocation(const char * uniformName) const;
 
+		// Typed setters for the active uniforms. The program must be in use.
+		// Values equal to the last uploaded ones are not sent again
+		void SetUniform(const char *uniformName, int value);
+		void SetUniform(const char *uniformName, float value);
+		void SetUniform(const char *uniformName, const glm::ivec2 &value);
+		void SetUniform(const char *uniformName, const glm::vec2 &value);
+		void SetUniform(const char *uniformName, const glm::vec3 &value);
+		void SetUniform(const char *uniformName, const glm::vec4 &value);
+
+		// Assigns the uniform block to a uniform buffer binding point.
+		// The binding is restored each time the program is linked
+		void BindUniformBlock(const char *blockName, GLuint bindingPoint);
+
+		// Preprocessor definitions inserted after the #version line.
+		// They take effect the next time the program is linked
+		void SetDefine(const std::string &name, const std::string &value);
+
+		// Returns the program specialized with the given definitions.
+		// Each combination is compiled once, on first use
+		Shader* GetVariant(const std::map<std::string, int> &defines);
+
 		void OnLoad(std::function<void()> onLoad);
 
 	private:
 		void GetUniforms();
-		static unsigned int CreateShader(const std::string &shaderFile, GLenum shaderType);
+		void ReflectUniforms();
+
+		// Returns the cached uniform if the new value differs from the last upload
+		struct Uniform;
+		Uniform* GetChangedUniform(const char *uniformName, const void *value, size_t size);
+		static std::string ReadShaderFile(const std::string &shaderFile);
+		std::string InjectDefines(const std::string &shaderCode) const;
+		void BindUniformBlocks() const;
+		void ClearVariants();
+		static unsigned int CreateShader(const std::string &shaderCode, GLenum shaderType);
+		static bool CheckShader(unsigned int shaderObject, const std::string &shaderFile, GLenum shaderType);
 		static unsigned int CreateProgram(const std::vector<unsigned int> &shaderObjects);
+		static bool CheckProgram(unsigned int programObject);
+		static void EnableParallelCompile();
+
+		// Program binary cache
+		unsigned long long ComputeSourceHash() const;
+		std::string GetBinaryCacheFile() const;
+		bool LoadProgramBinary();
+		void SaveProgramBinary() const;
+		static void MakeDirectory(const std::string &path);
 
 	public:
 		GLuint program;
@@ -72,9 +122,27 @@ class Shader
 		{
 			std::string file;
 			GLenum type;
+			std::string code;
+		};
+
+		// Active uniform reflected after linking
+		struct Uniform
+		{
+			GLint location;
+			GLenum type;
+			GLint size;
+			bool hasValue;
+			unsigned char value[16];
 		};
 
 		std::string shaderName;
 		std::vector<ShaderFile> shaderFiles;
+		std::vector<unsigned int> pendingShaders;
+		unsigned long long sourceHash;
+		bool loadedFromCache;
 		std::list<std::function<void()>> loadObservers;
+		std::unordered_map<std::string, Uniform> uniforms;
+		std::map<std::string, std::string> defines;
+		std::map<std::string, GLuint> uniformBlocks;
+		std::map<std::string, Shader*> variants;
 };
@@ -1,9 +1,12 @@
 #include "Texture2D.h"
 
-#include <thread>
+#include <cstring>
 #include <iostream>
+#include <algorithm>
 
 #include <include/gl.h>
+#include <Core/GPU/PixelBufferRing.h>
+#include <Core/Managers/ImageExporter.h>
 
 using namespace std;
 
@@ -16,12 +19,6 @@ using uchar = unsigned char;
 #include <stb/stb_image.h>
 #include <stb/stb_image_write.h>
 
-void write_image_thread(const char* fileName, uint width, uint height, uint channels, const uchar *data)
-{
-	stbi_write_png(fileName, width, height, channels, data, width * channels);
-	delete data;
-}
-
 const GLint pixelFormat[5] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
 const GLint internalFormat[][5] = {
 	{ 0, GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 },
@@ -30,6 +27,44 @@ const GLint internalFormat[][5] = {
 	{ 0, GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F }
 };
 
+// Client side format, type, channels and texel size for the storage formats
+struct StorageFormat
+{
+	GLenum internalFormat;
+	GLenum pixelFormat;
+	GLenum type;
+	uint channels;
+	uint bytesPerPixel;
+};
+
+const StorageFormat storageFormats[] = {
+	{ GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 },
+	{ GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2, 2 },
+	{ GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3, 3 },
+	{ GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4 },
+	{ GL_R16, GL_RED, GL_UNSIGNED_SHORT, 1, 2 },
+	{ GL_RG16, GL_RG, GL_UNSIGNED_SHORT, 2, 4 },
+	{ GL_RGB16, GL_RGB, GL_UNSIGNED_SHORT, 3, 6 },
+	{ GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, 4, 8 },
+	{ GL_R16F, GL_RED, GL_HALF_FLOAT, 1, 2 },
+	{ GL_RG16F, GL_RG, GL_HALF_FLOAT, 2, 4 },
+	{ GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 4, 8 },
+	{ GL_R32F, GL_RED, GL_FLOAT, 1, 4 },
+	{ GL_RG32F, GL_RG, GL_FLOAT, 2, 8 },
+	{ GL_RGBA32F, GL_RGBA, GL_FLOAT, 4, 16 },
+	{ GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 1, 4 }
+};
+
+const StorageFormat* GetStorageFormat(GLenum internalFormat)
+{
+	for (auto &format : storageFormats)
+	{
+		if (format.internalFormat == internalFormat)
+			return &format;
+	}
+	return nullptr;
+}
+
 Texture2D::Texture2D()
 {
 	width = 0;
@@ -38,10 +73,14 @@ Texture2D::Texture2D()
 	textureID = 0;
 	bitsPerPixel = 8;
 	cacheInMemory = false;
+	generateMipmaps = true;
 	targetType = GL_TEXTURE_2D;
 	wrappingMode = GL_REPEAT;
 	textureMinFilter = GL_LINEAR;
 	textureMagFilter = GL_LINEAR;
+	imageData = nullptr;
+	storageFormat = 0;
+	mipLevels = 0;
 }
 
 Texture2D::~Texture2D() {
@@ -58,6 +97,10 @@ void Texture2D::Init(GLuint gpuTextureID, unsigned int width, unsigned int heigh
 	this->width = width;
 	this->height = height;
 	this->channels = channels;
+
+	// The storage is owned by someone else and can't be reused
+	storageFormat = 0;
+	mipLevels = 0;
 }
 
 bool Texture2D::Load2D(const char* fileName, GLenum wrapping_mode)
@@ -80,8 +123,11 @@ bool Texture2D::Load2D(const char* fileName, GLenum wrapping_mode)
 	textureMinFilter = GL_LINEAR_MIPMAP_LINEAR;
 	wrappingMode = wrapping_mode;
 
-	Init2DTexture(width, height, chn);
-	glTexImage2D(targetType, 0, internalFormat[0][chn], width, height, 0, pixelFormat[chn], GL_UNSIGNED_BYTE, imageData);
+	// Loading an image of the same size and format reuses the storage
+	AllocateStorage(width, height, internalFormat[0][chn], GetMipLevelCount(width, height));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(targetType, 0, 0, 0, width, height, pixelFormat[chn], GL_UNSIGNED_BYTE, imageData);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	glGenerateMipmap(targetType);
 	glBindTexture(targetType, 0);
 	CheckOpenGLError();
@@ -89,6 +135,7 @@ bool Texture2D::Load2D(const char* fileName, GLenum wrapping_mode)
 	if (cacheInMemory == false)
 	{
 		stbi_image_free(imageData);
+		imageData = nullptr;
 	}
 
 	return true;
@@ -106,6 +153,11 @@ void Texture2D::SaveToFile(const char * fileName)
 	stbi_write_png(fileName, width, height, channels, imageData, width * channels);
 }
 
+void Texture2D::SaveToFileAsync(const char *fileName, function<void(const string&, bool)> onSaved) const
+{
+	ImageExporter::SaveToFile(this, fileName, onSaved);
+}
+
 void Texture2D::CacheInMemory(bool state)
 {
 	cacheInMemory = state;
@@ -113,31 +165,118 @@ void Texture2D::CacheInMemory(bool state)
 
 void Texture2D::UploadNewData(const uchar *img)
 {
+	UploadNewData(img, 0, 0, width, height);
+}
+
+void Texture2D::UploadNewData(const ushort *img)
+{
+	UploadNewData(img, 0, 0, width, height);
+}
+
+void Texture2D::UploadNewData(const uchar *img, int x, int y, int width, int height)
+{
+	uint pixelSize = channels * sizeof(uchar);
+	StreamRegion(img, pixelFormat[channels], GL_UNSIGNED_BYTE, pixelSize, x, y, width, height, width * pixelSize);
+}
+
+void Texture2D::UploadNewData(const ushort *img, int x, int y, int width, int height)
+{
+	uint pixelSize = channels * sizeof(ushort);
+	StreamRegion(img, pixelFormat[channels], GL_UNSIGNED_SHORT, pixelSize, x, y, width, height, width * pixelSize);
+}
+
+void Texture2D::UploadRegion(int x, int y, int width, int height, int stride, const void *data)
+{
+	// The client data is expected in the layout of the storage format
+	const StorageFormat *format = GetStorageFormat(storageFormat);
+	if (format == nullptr)
+	{
+		cout << "UploadRegion needs storage allocated with AllocateStorage" << endl;
+		return;
+	}
+
+	StreamRegion(data, format->pixelFormat, format->type, format->bytesPerPixel, x, y, width, height, stride);
+}
+
+void Texture2D::StreamRegion(const void *img, GLenum format, GLenum type, uint bytesPerPixel, int x, int y, int width, int height, size_t stride)
+{
+	if (!img || width <= 0 || height <= 0)
+		return;
+
+	size_t rowSize = (size_t)width * bytesPerPixel;
+	size_t size = rowSize * height;
+
 	Bind();
-	glTexSubImage2D(targetType, 0, 0, 0, width, height, pixelFormat[channels], GL_UNSIGNED_BYTE, img);
-	glGenerateMipmap(targetType);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// The texture copy reads from the pixel buffer asynchronously
+	PixelBufferRing *uploadRing = PixelBufferRing::GetShared();
+	unsigned char *buffer = static_cast<unsigned char*>(uploadRing->Map(size));
+	if (buffer)
+	{
+		// Rows are packed in the pixel buffer
+		const unsigned char *source = static_cast<const unsigned char*>(img);
+		if (stride == rowSize)
+			memcpy(buffer, source, size);
+		else
+			for (int row = 0; row < height; row++)
+				memcpy(buffer + row * rowSize, source + row * stride, rowSize);
+
+		glTexSubImage2D(targetType, 0, x, y, width, height, format, type, 0);
+		uploadRing->Submit();
+	}
+	else
+	{
+		// The stride must be a multiple of the pixel size
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(stride / bytesPerPixel));
+		glTexSubImage2D(targetType, 0, x, y, width, height, format, type, img);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (generateMipmaps && mipLevels != 1)
+		glGenerateMipmap(targetType);
 	UnBind();
 }
 
-void Texture2D::UploadNewData(const ushort *img)
+void Texture2D::SetMipmapGeneration(bool state)
+{
+	generateMipmaps = state;
+}
+
+void Texture2D::GenerateMipmaps()
 {
 	Bind();
-	glTexSubImage2D(targetType, 0, 0, 0, width, height, pixelFormat[channels], GL_UNSIGNED_SHORT, img);
+	if (textureMinFilter != GL_LINEAR_MIPMAP_LINEAR)
+	{
+		textureMinFilter = GL_LINEAR_MIPMAP_LINEAR;
+		glTexParameteri(targetType, GL_TEXTURE_MIN_FILTER, textureMinFilter);
+	}
 	glGenerateMipmap(targetType);
 	UnBind();
 }
 
 void Texture2D::Create(const unsigned char* img, int width, int height, int chn)
 {
-	Init2DTexture(width, height, chn);
-	glTexImage2D(targetType, 0, internalFormat[0][chn], width, height, 0, pixelFormat[chn], GL_UNSIGNED_BYTE, (void*)img);
+	AllocateStorage(width, height, internalFormat[0][chn]);
+	if (img)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(targetType, 0, 0, 0, width, height, pixelFormat[chn], GL_UNSIGNED_BYTE, img);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
 	UnBind();
 }
 
 void Texture2D::CreateU16(const unsigned short* img, int width, int height, int chn)
 {
-	Init2DTexture(width, height, chn);
-	glTexImage2D(targetType, 0, internalFormat[1][chn], width, height, 0, pixelFormat[chn], GL_UNSIGNED_SHORT, (void*)img);
+	AllocateStorage(width, height, internalFormat[1][chn]);
+	if (img)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(targetType, 0, 0, 0, width, height, pixelFormat[chn], GL_UNSIGNED_SHORT, img);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
 	UnBind();
 }
 
@@ -171,16 +310,34 @@ void Texture2D::CreateFrameBufferTexture(uint width, uint height, uint targetID,
 {
 	bitsPerPixel = precision;
 	int prec = precision / 8 - 1;
-	Init2DTexture(width, height, 4);
-	glTexImage2D(targetType, 0, internalFormat[prec][4], width, height, 0, pixelFormat[4], GL_UNSIGNED_BYTE, 0);
+	AllocateStorage(width, height, internalFormat[prec][4]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + targetID, GL_TEXTURE_2D, textureID, 0);
+	UnBind();
+}
+
+void Texture2D::CreateColorAttachment(uint width, uint height, uint targetID, GLenum internalFormat, uint mipLevels)
+{
+	if (GetStorageFormat(internalFormat) == nullptr)
+	{
+		cout << "Unsupported render target format: " << internalFormat << endl;
+		return;
+	}
+
+	AllocateStorage(width, height, internalFormat, mipLevels);
+
+	// The memory of the target is counted from the format it was asked for
+	GLint actualFormat = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &actualFormat);
+	if (static_cast<GLenum>(actualFormat) != internalFormat)
+		cout << "Render target format " << internalFormat << " was allocated as " << actualFormat << endl;
+
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + targetID, GL_TEXTURE_2D, textureID, 0);
 	UnBind();
 }
 
 void Texture2D::CreateDepthBufferTexture(uint width, uint height)
 {
-	Init2DTexture(width, height, 1);
-	glTexImage2D(targetType, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, 0);
+	AllocateStorage(width, height, GL_DEPTH_COMPONENT32F);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textureID, 0);
 	UnBind();
 }
@@ -275,17 +432,88 @@ void Texture2D::SetFiltering(GLenum minFilter, GLenum magFilter)
 	}
 }
 
-void Texture2D::Init2DTexture(unsigned int width, unsigned int height, unsigned int channels)
+bool Texture2D::AllocateStorage(uint width, uint height, GLenum internalFormat, uint mipLevels)
 {
+	const StorageFormat *format = GetStorageFormat(internalFormat);
+	if (format == nullptr)
+	{
+		cout << "Unsupported texture storage format: " << internalFormat << endl;
+		return false;
+	}
+
+	mipLevels = min(max(mipLevels, 1u), GetMipLevelCount(width, height));
+
+	bool reuse = textureID && storageFormat == internalFormat && this->mipLevels == mipLevels
+		&& this->width == width && this->height == height;
+
 	this->width = width;
 	this->height = height;
-	this->channels = channels;
+	this->channels = format->channels;
+
+	if (!reuse)
+	{
+		if (textureID)
+			glDeleteTextures(1, &textureID);
+		glGenTextures(1, &textureID);
+	}
 
-	if (textureID)
-		glDeleteTextures(1, &textureID);
-	glGenTextures(1, &textureID);
 	glBindTexture(targetType, textureID);
 	SetTextureParameters();
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	if (!reuse)
+	{
+		storageFormat = internalFormat;
+		this->mipLevels = mipLevels;
+
+		if (GLEW_ARB_texture_storage)
+		{
+			glTexStorage2D(targetType, mipLevels, internalFormat, width, height);
+		}
+		else
+		{
+			// Same levels as the immutable storage, so the texture is complete
+			for (uint level = 0; level < mipLevels; level++)
+			{
+				uint levelWidth = max(1u, width >> level);
+				uint levelHeight = max(1u, height >> level);
+				glTexImage2D(targetType, level, internalFormat, levelWidth, levelHeight, 0, format->pixelFormat, format->type, 0);
+			}
+			glTexParameteri(targetType, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+		}
+	}
+
 	CheckOpenGLError();
+	return !reuse;
+}
+
+uint Texture2D::GetMipLevelCount(uint width, uint height)
+{
+	uint levels = 1;
+	for (uint size = max(width, height); size > 1; size >>= 1)
+		levels++;
+	return levels;
+}
+
+uint Texture2D::GetBytesPerPixel(GLenum internalFormat)
+{
+	const StorageFormat *format = GetStorageFormat(internalFormat);
+	return format ? format->bytesPerPixel : 0;
+}
+
+bool Texture2D::GetTransferFormat(GLenum internalFormat, GLenum &pixelFormat, GLenum &type, uint &channels)
+{
+	const StorageFormat *format = GetStorageFormat(internalFormat);
+	if (format == nullptr)
+		return false;
+
+	pixelFormat = format->pixelFormat;
+	type = format->type;
+	channels = format->channels;
+	return true;
+}
+
+uint Texture2D::GetMipLevels() const
+{
+	return mipLevels;
 }
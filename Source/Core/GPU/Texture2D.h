@@ -1,4 +1,7 @@
 #pragma once
+#include <string>
+#include <functional>
+
 #include <include/gl.h>
 #include <include/utils.h>
 
@@ -12,8 +15,31 @@ class Texture2D
 		void BindToTextureUnit(GLenum TextureUnit) const;
 		void UnBind() const;
 
+		// Uploads are streamed through a ring of pixel buffers so the CPU
+		// doesn't wait for the transfer. Region data is tightly packed
 		void UploadNewData(const uchar *img);
 		void UploadNewData(const ushort *img);
+		void UploadNewData(const uchar *img, int x, int y, int width, int height);
+		void UploadNewData(const ushort *img, int x, int y, int width, int height);
+
+		// Updates a rectangle of the base level with data in the storage format.
+		// The stride is the distance in bytes between the rows of the source
+		void UploadRegion(int x, int y, int width, int height, int stride, const void *data);
+		void GenerateMipmaps();
+
+		// Textures that are never minified can skip the mipmaps after uploads
+		void SetMipmapGeneration(bool state);
+
+		// Immutable storage with an explicit number of levels. The texture is
+		// kept when the size, format and levels don't change. Returns true
+		// if a new texture object was created
+		bool AllocateStorage(uint width, uint height, GLenum internalFormat, uint mipLevels = 1);
+		static uint GetMipLevelCount(uint width, uint height);
+		static uint GetBytesPerPixel(GLenum internalFormat);
+
+		// Client side layout of the texels of a storage format, false if it's unknown
+		static bool GetTransferFormat(GLenum internalFormat, GLenum &pixelFormat, GLenum &type, uint &channels);
+		uint GetMipLevels() const;
 
 		void Init(GLuint gpuTextureID, unsigned int width, unsigned int height, unsigned int channels);
 		void Create(const unsigned char* img, int width, int height, int chn);
@@ -21,10 +47,14 @@ class Texture2D
 
 		void CreateCubeTexture(const float* data, uint width, uint height, uint chn);
 		void CreateFrameBufferTexture(uint width, uint height, uint targetID, uint precision = 32);
+		void CreateColorAttachment(uint width, uint height, uint targetID, GLenum internalFormat, uint mipLevels = 1);
 		void CreateDepthBufferTexture(uint width, uint height);
 
 		bool Load2D(const char* fileName, GLenum wrappingMode = GL_REPEAT);
 		void SaveToFile(const char* fileName);
+
+		// Returns immediately, the callback runs on the render thread once the file is written
+		void SaveToFileAsync(const char *fileName, std::function<void(const std::string &fileName, bool saved)> onSaved = nullptr) const;
 		void CacheInMemory(bool state);
 
 		unsigned int GetWidth() const;
@@ -41,14 +71,17 @@ class Texture2D
 
 	private:
 		void SetTextureParameters();
-		void Init2DTexture(unsigned int width, unsigned int height, unsigned int channels);
+		void StreamRegion(const void *img, GLenum format, GLenum type, unsigned int bytesPerPixel, int x, int y, int width, int height, size_t stride);
 
 	private:
 		bool cacheInMemory;
+		bool generateMipmaps;
 		unsigned int bitsPerPixel;
 		unsigned int width;
 		unsigned int height;
 		unsigned int channels;
+		unsigned int mipLevels;
+		GLenum storageFormat;
 
 		GLuint targetType;
 		GLuint textureID;
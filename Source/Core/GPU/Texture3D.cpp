@@ -0,0 +1,117 @@
+#include "Texture3D.h"
+
+#include <iostream>
+
+#include <Core/GPU/Texture2D.h>
+
+using namespace std;
+
+Texture3D::Texture3D()
+{
+	width = 0;
+	height = 0;
+	depth = 0;
+	storageFormat = 0;
+	pixelFormat = 0;
+	pixelType = 0;
+	textureID = 0;
+}
+
+Texture3D::~Texture3D()
+{
+	if (textureID)
+		glDeleteTextures(1, &textureID);
+}
+
+bool Texture3D::AllocateStorage(uint width, uint height, uint depth, GLenum internalFormat)
+{
+	if (textureID && this->width == width && this->height == height
+		&& this->depth == depth && storageFormat == internalFormat)
+	{
+		return false;
+	}
+
+	uint channels = 0;
+	if (!Texture2D::GetTransferFormat(internalFormat, pixelFormat, pixelType, channels))
+	{
+		cout << "Unsupported 3D texture format: " << internalFormat << endl;
+		return false;
+	}
+
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	storageFormat = internalFormat;
+
+	if (textureID)
+		glDeleteTextures(1, &textureID);
+	glGenTextures(1, &textureID);
+
+	glBindTexture(GL_TEXTURE_3D, textureID);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	if (GLEW_ARB_texture_storage)
+	{
+		glTexStorage3D(GL_TEXTURE_3D, 1, internalFormat, width, height, depth);
+	}
+	else
+	{
+		glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, width, height, depth, 0, pixelFormat, pixelType, 0);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	CheckOpenGLError();
+	return true;
+}
+
+void Texture3D::UploadData(const void *data)
+{
+	if (!data || !textureID)
+		return;
+
+	// Lookup tables are small and rarely change, so there is no upload ring
+	glBindTexture(GL_TEXTURE_3D, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, pixelFormat, pixelType, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	CheckOpenGLError();
+}
+
+void Texture3D::BindToTextureUnit(GLenum textureUnit) const
+{
+	if (!textureID) return;
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_3D, textureID);
+}
+
+void Texture3D::UnBind() const
+{
+	glBindTexture(GL_TEXTURE_3D, 0);
+	CheckOpenGLError();
+}
+
+GLuint Texture3D::GetTextureID() const
+{
+	return textureID;
+}
+
+uint Texture3D::GetWidth() const
+{
+	return width;
+}
+
+uint Texture3D::GetHeight() const
+{
+	return height;
+}
+
+uint Texture3D::GetDepth() const
+{
+	return depth;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <include/gl.h>
+#include <include/utils.h>
+
+// Volume texture sampled with 3 coordinates, used for lookup tables
+// indexed by color. The texels are read without filtering
+class Texture3D
+{
+	public:
+		Texture3D();
+		~Texture3D();
+
+		// Immutable storage, kept when the size and format don't change.
+		// Returns true if a new texture object was created
+		bool AllocateStorage(uint width, uint height, uint depth, GLenum internalFormat);
+
+		// Data in the storage format with the rows tightly packed
+		void UploadData(const void *data);
+
+		void BindToTextureUnit(GLenum textureUnit) const;
+		void UnBind() const;
+
+		GLuint GetTextureID() const;
+		uint GetWidth() const;
+		uint GetHeight() const;
+		uint GetDepth() const;
+
+	private:
+		uint width;
+		uint height;
+		uint depth;
+		GLenum storageFormat;
+		GLenum pixelFormat;
+		GLenum pixelType;
+
+		GLuint textureID;
+};
@@ -0,0 +1,171 @@
+#include "TextureArray.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <Core/GPU/Texture2D.h>
+#include <Core/GPU/PixelBufferRing.h>
+
+using namespace std;
+
+TextureArray::TextureArray()
+{
+	width = 0;
+	height = 0;
+	layers = 0;
+	channels = 0;
+	bytesPerPixel = 0;
+	storageFormat = 0;
+	pixelFormat = 0;
+	pixelType = 0;
+	textureID = 0;
+	FBO = 0;
+}
+
+TextureArray::~TextureArray()
+{
+	if (FBO)
+		glDeleteFramebuffers(1, &FBO);
+	if (textureID)
+		glDeleteTextures(1, &textureID);
+}
+
+bool TextureArray::AllocateStorage(uint width, uint height, uint layers, GLenum internalFormat)
+{
+	if (textureID && this->width == width && this->height == height
+		&& this->layers == layers && storageFormat == internalFormat)
+	{
+		return false;
+	}
+
+	if (!Texture2D::GetTransferFormat(internalFormat, pixelFormat, pixelType, channels))
+	{
+		cout << "Unsupported texture array format: " << internalFormat << endl;
+		return false;
+	}
+
+	this->width = width;
+	this->height = height;
+	this->layers = layers;
+	storageFormat = internalFormat;
+	bytesPerPixel = Texture2D::GetBytesPerPixel(internalFormat);
+
+	if (textureID)
+		glDeleteTextures(1, &textureID);
+	glGenTextures(1, &textureID);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	if (GLEW_ARB_texture_storage)
+	{
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalFormat, width, height, layers);
+	}
+	else
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, layers, 0, pixelFormat, pixelType, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// The frame buffer has to be attached to the new texture
+	if (FBO)
+	{
+		glDeleteFramebuffers(1, &FBO);
+		FBO = 0;
+	}
+
+	CheckOpenGLError();
+	return true;
+}
+
+void TextureArray::UploadLayer(uint layer, const void *data)
+{
+	if (!data || layer >= layers)
+		return;
+
+	size_t size = (size_t)width * height * bytesPerPixel;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// Same streaming path as Texture2D::UploadNewData
+	PixelBufferRing *uploadRing = PixelBufferRing::GetShared();
+	void *buffer = uploadRing->Map(size);
+	if (buffer)
+	{
+		memcpy(buffer, data, size);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, pixelFormat, pixelType, 0);
+		uploadRing->Submit();
+	}
+	else
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, pixelFormat, pixelType, data);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	CheckOpenGLError();
+}
+
+void TextureArray::BindToTextureUnit(GLenum textureUnit) const
+{
+	if (!textureID) return;
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+}
+
+void TextureArray::UnBind() const
+{
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	CheckOpenGLError();
+}
+
+void TextureArray::BindAsRenderTarget() const
+{
+	// Created on first use, most arrays are only sampled
+	if (!FBO)
+	{
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+		// Attaching the whole texture makes the frame buffer layered
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureID, 0);
+		GLenum drawBuffer = GL_COLOR_ATTACHMENT0;
+		glDrawBuffers(1, &drawBuffer);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "LAYERED FRAMEBUFFER NOT COMPLETE" << endl;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, width, height);
+}
+
+GLuint TextureArray::GetTextureID() const
+{
+	return textureID;
+}
+
+uint TextureArray::GetWidth() const
+{
+	return width;
+}
+
+uint TextureArray::GetHeight() const
+{
+	return height;
+}
+
+uint TextureArray::GetLayers() const
+{
+	return layers;
+}
+
+uint TextureArray::GetNrChannels() const
+{
+	return channels;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <include/gl.h>
+#include <include/utils.h>
+
+// Layers of the same size and format in a GL_TEXTURE_2D_ARRAY. The array
+// can also be rendered to, the geometry shader picks the layer of each
+// primitive with gl_Layer so all the layers are drawn in a single call
+class TextureArray
+{
+	public:
+		TextureArray();
+		~TextureArray();
+
+		// Immutable storage, kept when the size, layers and format don't change.
+		// Returns true if a new texture object was created
+		bool AllocateStorage(uint width, uint height, uint layers, GLenum internalFormat);
+
+		// Data in the storage format with the rows tightly packed
+		void UploadLayer(uint layer, const void *data);
+
+		void BindToTextureUnit(GLenum textureUnit) const;
+		void UnBind() const;
+
+		// Binds the layered frame buffer and sets the viewport to the layer size
+		void BindAsRenderTarget() const;
+
+		GLuint GetTextureID() const;
+		uint GetWidth() const;
+		uint GetHeight() const;
+		uint GetLayers() const;
+		uint GetNrChannels() const;
+
+	private:
+		uint width;
+		uint height;
+		uint layers;
+		uint channels;
+		uint bytesPerPixel;
+		GLenum storageFormat;
+		GLenum pixelFormat;
+		GLenum pixelType;
+
+		GLuint textureID;
+		mutable GLuint FBO;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstring>
+
+#include <include/gl.h>
+
+// Uniform buffer holding a single std140 block shared by several programs
+template <class BlockData>
+class UBO
+{
+	public:
+		UBO()
+		{
+			hasData = false;
+			glGenBuffers(1, &ubo);
+			Bind();
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(BlockData), NULL, GL_DYNAMIC_DRAW);
+			Unbind();
+		}
+
+		~UBO()
+		{
+			glDeleteBuffers(1, &ubo);
+		};
+
+		// Uploads the block only if it differs from the previous one
+		void SetBufferData(const BlockData &data)
+		{
+			if (hasData && memcmp(&this->data, &data, sizeof(BlockData)) == 0)
+				return;
+
+			hasData = true;
+			this->data = data;
+
+			Bind();
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(BlockData), &data);
+			Unbind();
+		}
+
+		void BindBuffer(GLuint index) const
+		{
+			glBindBufferBase(GL_UNIFORM_BUFFER, index, ubo);
+		}
+
+		const BlockData& GetData() const
+		{
+			return data;
+		}
+
+	private:
+		inline void Bind() const
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+			CheckOpenGLError();
+		}
+
+		static inline void Unbind()
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			CheckOpenGLError();
+		}
+
+	private:
+		unsigned int ubo;
+		bool hasData;
+		BlockData data;
+};
@@ -0,0 +1,306 @@
+#include "ImageExporter.h"
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <Core/GPU/Texture2D.h>
+#include <Core/GPU/TextureArray.h>
+#include <stb/stb_image_write.h>
+
+using namespace std;
+
+list<ImageExporter::Readback> ImageExporter::readbacks;
+vector<thread> ImageExporter::workers;
+queue<ImageExporter::EncodeJob*> ImageExporter::pendingJobs;
+queue<ImageExporter::EncodeJob*> ImageExporter::completedJobs;
+mutex ImageExporter::jobsMutex;
+condition_variable ImageExporter::jobsAvailable;
+condition_variable ImageExporter::jobsDone;
+unsigned int ImageExporter::activeJobs = 0;
+size_t ImageExporter::pendingBytes = 0;
+bool ImageExporter::stopWorkers = false;
+
+static const GLenum readFormat[5] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+void ImageExporter::SaveToFile(const Texture2D *texture, const string &fileName, Callback onSaved)
+{
+	if (!texture)
+	{
+		if (onSaved)
+			onSaved(fileName, false);
+		return;
+	}
+
+	StartReadback(GL_TEXTURE_2D, texture->GetTextureID(), texture->GetWidth(), texture->GetHeight(),
+		1, texture->GetNrChannels(), { fileName }, onSaved);
+}
+
+void ImageExporter::SaveLayers(const TextureArray *textures, const vector<string> &fileNames, Callback onSaved)
+{
+	if (fileNames.empty())
+		return;
+
+	if (!textures || fileNames.size() > textures->GetLayers())
+	{
+		if (onSaved)
+			for (auto &fileName : fileNames)
+				onSaved(fileName, false);
+		return;
+	}
+
+	StartReadback(GL_TEXTURE_2D_ARRAY, textures->GetTextureID(), textures->GetWidth(), textures->GetHeight(),
+		(unsigned int)fileNames.size(), textures->GetNrChannels(), fileNames, onSaved);
+}
+
+void ImageExporter::StartReadback(GLenum target, GLuint textureID, unsigned int width, unsigned int height,
+	unsigned int layers, unsigned int channels, const vector<string> &fileNames, Callback onSaved)
+{
+	if (channels < 1 || channels > 4)
+	{
+		if (onSaved)
+			for (auto &fileName : fileNames)
+				onSaved(fileName, false);
+		return;
+	}
+
+	Readback readback;
+	readback.width = width;
+	readback.height = height;
+	readback.channels = channels;
+	readback.fileNames = fileNames;
+	readback.onSaved = onSaved;
+
+	// Only the layers that are saved are read
+	size_t layerSize = (size_t)width * height * channels;
+	size_t size = layerSize * layers;
+	readback.size = size;
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		pendingBytes += size;
+	}
+
+	// The copy into the buffer is queued on the GPU, nothing waits for it here
+	glGenBuffers(1, &readback.buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D_ARRAY)
+	{
+		// One read for each layer through a framebuffer, one after the other in the buffer
+		GLint boundFramebuffer = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &boundFramebuffer);
+
+		GLuint framebuffer = 0;
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		for (unsigned int layer = 0; layer < layers; layer++)
+		{
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureID, 0, layer);
+			glReadPixels(0, 0, width, height, readFormat[channels], GL_UNSIGNED_BYTE, (void*)(layer * layerSize));
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, boundFramebuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+	else
+	{
+		glBindTexture(target, textureID);
+		glGetTexImage(target, 0, readFormat[channels], GL_UNSIGNED_BYTE, 0);
+		glBindTexture(target, 0);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	CheckOpenGLError();
+	readbacks.push_back(readback);
+}
+
+void ImageExporter::Update()
+{
+	for (auto it = readbacks.begin(); it != readbacks.end(); )
+	{
+		if (CollectReadback(*it, false))
+			it = readbacks.erase(it);
+		else
+			++it;
+	}
+
+	DispatchCompleted();
+}
+
+bool ImageExporter::HasPendingReadbacks()
+{
+	return !readbacks.empty();
+}
+
+void ImageExporter::WaitForPending(size_t maxBytes)
+{
+	auto isBelow = [maxBytes] {
+		lock_guard<mutex> lock(jobsMutex);
+		return pendingBytes <= maxBytes;
+	};
+
+	// The readbacks become jobs first, only the encoding frees their pixels
+	if (!isBelow())
+	{
+		for (auto &readback : readbacks)
+			CollectReadback(readback, true);
+		readbacks.clear();
+
+		unique_lock<mutex> lock(jobsMutex);
+		jobsDone.wait(lock, [maxBytes] { return pendingBytes <= maxBytes; });
+	}
+
+	DispatchCompleted();
+}
+
+void ImageExporter::Shutdown()
+{
+	for (auto &readback : readbacks)
+		CollectReadback(readback, true);
+	readbacks.clear();
+
+	// Let the workers drain the queue before stopping them
+	{
+		unique_lock<mutex> lock(jobsMutex);
+		jobsDone.wait(lock, [] { return pendingJobs.empty() && activeJobs == 0; });
+		stopWorkers = true;
+	}
+	jobsAvailable.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+	workers.clear();
+
+	DispatchCompleted();
+}
+
+bool ImageExporter::CollectReadback(Readback &readback, bool wait)
+{
+	GLuint64 timeout = wait ? GL_TIMEOUT_IGNORED : 0;
+	GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(readback.fence);
+
+	// One job for each layer, so the layers are encoded in parallel
+	size_t layerSize = (size_t)readback.width * readback.height * readback.channels;
+	size_t size = layerSize * readback.fileNames.size();
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	unsigned char *pixels = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+
+	vector<EncodeJob*> jobs;
+	for (size_t layer = 0; layer < readback.fileNames.size(); layer++)
+	{
+		EncodeJob *job = new EncodeJob();
+		job->width = readback.width;
+		job->height = readback.height;
+		job->channels = readback.channels;
+		job->fileName = readback.fileNames[layer];
+		job->onSaved = readback.onSaved;
+		job->saved = false;
+
+		if (pixels && status != GL_WAIT_FAILED)
+			job->pixels.assign(pixels + layer * layerSize, pixels + (layer + 1) * layerSize);
+
+		jobs.push_back(job);
+	}
+
+	if (pixels)
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(1, &readback.buffer);
+
+	StartWorkers();
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		pendingBytes -= readback.size;
+		for (auto job : jobs)
+		{
+			pendingBytes += job->pixels.size();
+			pendingJobs.push(job);
+		}
+	}
+	jobsAvailable.notify_all();
+
+	return true;
+}
+
+void ImageExporter::StartWorkers()
+{
+	if (!workers.empty())
+		return;
+
+	// Encoding is the slow part, leave the rest of the cores to the frame
+	unsigned int count = max(1u, thread::hardware_concurrency() / 2);
+
+	stopWorkers = false;
+	for (unsigned int i = 0; i < count; i++)
+		workers.push_back(thread(WorkerLoop));
+}
+
+void ImageExporter::WorkerLoop()
+{
+	while (true)
+	{
+		EncodeJob *job = nullptr;
+		{
+			unique_lock<mutex> lock(jobsMutex);
+			jobsAvailable.wait(lock, [] { return stopWorkers || !pendingJobs.empty(); });
+			if (pendingJobs.empty())
+				return;
+
+			job = pendingJobs.front();
+			pendingJobs.pop();
+			activeJobs++;
+		}
+
+		if (!job->pixels.empty())
+		{
+			int stride = job->width * job->channels;
+			job->saved = stbi_write_png(job->fileName.c_str(), job->width, job->height, job->channels, &job->pixels[0], stride) != 0;
+		}
+
+		// The pixels are not needed while the job waits for its callback
+		size_t size = job->pixels.size();
+		vector<unsigned char>().swap(job->pixels);
+
+		{
+			lock_guard<mutex> lock(jobsMutex);
+			pendingBytes -= size;
+			completedJobs.push(job);
+			activeJobs--;
+		}
+		jobsDone.notify_all();
+
+		// Wake the loop if it's waiting for events
+		glfwPostEmptyEvent();
+	}
+}
+
+void ImageExporter::DispatchCompleted()
+{
+	queue<EncodeJob*> completed;
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		swap(completed, completedJobs);
+	}
+
+	while (!completed.empty())
+	{
+		EncodeJob *job = completed.front();
+		completed.pop();
+
+		if (job->onSaved)
+			job->onSaved(job->fileName, job->saved);
+		delete job;
+	}
+}
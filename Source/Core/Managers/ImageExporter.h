@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <include/gl.h>
+
+class Texture2D;
+class TextureArray;
+
+// Saves textures to disk without stalling the frame. The pixels are read
+// back into a pixel buffer, collected once the GPU signals the fence and
+// encoded by a pool of worker threads. Callbacks run on the render thread
+class ImageExporter
+{
+	public:
+		typedef std::function<void(const std::string &fileName, bool saved)> Callback;
+
+		static void SaveToFile(const Texture2D *texture, const std::string &fileName, Callback onSaved = nullptr);
+
+		// Saves the first layers of the array, one file for each name.
+		// Only those layers are read back, together in one buffer
+		static void SaveLayers(const TextureArray *textures, const std::vector<std::string> &fileNames, Callback onSaved = nullptr);
+
+		// Collects finished readbacks and reports finished files.
+		// Called once per frame by the world loop
+		static void Update();
+
+		// Readbacks need the loop to keep polling until their fence is signaled.
+		// Workers wake the loop with an empty event when they are done
+		static bool HasPendingReadbacks();
+
+		// Blocks until the pixels read back and waiting to be encoded take at
+		// most maxBytes, for producers that queue images faster than they are saved
+		static void WaitForPending(size_t maxBytes);
+
+		// Completes all the exports and stops the workers
+		static void Shutdown();
+
+	protected:
+		ImageExporter() = delete;
+		~ImageExporter() = delete;
+
+	private:
+		struct Readback
+		{
+			GLuint buffer;
+			GLsync fence;
+			size_t size;
+			unsigned int width;
+			unsigned int height;
+			unsigned int channels;
+			std::vector<std::string> fileNames;
+			Callback onSaved;
+		};
+
+		struct EncodeJob
+		{
+			std::vector<unsigned char> pixels;
+			unsigned int width;
+			unsigned int height;
+			unsigned int channels;
+			std::string fileName;
+			Callback onSaved;
+			bool saved;
+		};
+
+		static void StartReadback(GLenum target, GLuint textureID, unsigned int width, unsigned int height,
+			unsigned int layers, unsigned int channels, const std::vector<std::string> &fileNames, Callback onSaved);
+		static bool CollectReadback(Readback &readback, bool wait);
+		static void StartWorkers();
+		static void WorkerLoop();
+		static void DispatchCompleted();
+
+	private:
+		static std::list<Readback> readbacks;
+		static std::vector<std::thread> workers;
+		static std::queue<EncodeJob*> pendingJobs;
+		static std::queue<EncodeJob*> completedJobs;
+		static std::mutex jobsMutex;
+		static std::condition_variable jobsAvailable;
+		static std::condition_variable jobsDone;
+		static unsigned int activeJobs;
+
+		// Pixels of the readbacks and of the jobs that aren't encoded yet
+		static size_t pendingBytes;
+		static bool stopWorkers;
+};
@@ -8,4 +8,5 @@ namespace RESOURCE_PATH
 	const std::string MODELS = ROOT + "Models/";
 	const std::string TEXTURES = ROOT + "Textures/";
 	const std::string SHADERS = ROOT + "Shaders/";
+	const std::string SHADER_CACHE = ROOT + "ShaderCache/";
 }
\ No newline at end of file
@@ -25,6 +25,7 @@ WindowProperties::WindowProperties()
 	visible = true;
 	hideOnClose = false;
 	vSync = true;
+	headless = false;
 }
 
 WindowObject::WindowObject(WindowProperties properties)
@@ -40,6 +41,16 @@ WindowObject::WindowObject(WindowProperties properties)
 	deltaFrameTime = 0;
 	props.aspectRatio = float(props.resolution.x) / props.resolution.y;
 
+	// EGL can create the context without a visible surface.
+	// The native API is used if it's not available
+	if (props.headless)
+	{
+		props.visible = false;
+		props.centered = false;
+		props.fullScreen = false;
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+	}
+
 	// Set context version
 	glfwWindowHint(GLFW_VISIBLE, props.visible);
 
@@ -158,6 +169,11 @@ void WindowObject::PollEvents() const
 	glfwPollEvents();
 }
 
+void WindowObject::WaitEvents() const
+{
+	glfwWaitEvents();
+}
+
 void WindowObject::ComputeFrameTime()
 {
 	frameID++;
@@ -181,6 +197,11 @@ void WindowObject::FullScreen()
 void WindowObject::WindowMode()
 {
 	window = glfwCreateWindow(props.resolution.x, props.resolution.y, props.name.c_str(), NULL, NULL);
+	if (window == nullptr && props.headless)
+	{
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_NATIVE_CONTEXT_API);
+		window = glfwCreateWindow(props.resolution.x, props.resolution.y, props.name.c_str(), NULL, NULL);
+	}
 	assert(window != nullptr);
 	glfwMakeContextCurrent(window);
 
@@ -365,6 +386,12 @@ void WindowObject::SetSize(int width, int height)
 	resizeEvent = true;
 }
 
+void WindowObject::SetTitle(const std::string &title)
+{
+	// The name in the properties is kept as the default title
+	glfwSetWindowTitle(window, title.c_str());
+}
+
 glm::ivec2 WindowObject::GetResolution() const
 {
 	return props.resolution;
@@ -22,6 +22,9 @@ class WindowProperties
 		bool centered;
 		bool hideOnClose;
 		bool vSync;
+
+		// Offscreen rendering, the window is never shown
+		bool headless;
 };
 
 /*
@@ -59,6 +62,7 @@ class WindowObject
 
 		// Window Information
 		void SetSize(int width, int height);
+		void SetTitle(const std::string &title);
 		glm::ivec2 GetResolution() const;
 
 		// OpenGL State
@@ -66,6 +70,7 @@ class WindowObject
 	
 		// Window Event
 		void PollEvents() const;
+		void WaitEvents() const;
 
 		// Get Input State
 		bool KeyHold(int keyCode) const;
@@ -11,6 +11,8 @@ World::World()
 	deltaTime = 0;
 	paused = false;
 	shouldClose = false;
+	waitForEvents = false;
+	firstFrame = true;
 
 	window = Engine::GetWindow();
 }
@@ -37,6 +39,11 @@ void World::Exit()
 	window->Close();
 }
 
+void World::SetWaitForEvents(bool state)
+{
+	waitForEvents = state;
+}
+
 double World::GetLastFrameTime()
 {
 	return deltaTime;
@@ -51,8 +58,17 @@ void World::ComputeFrameDeltaTime()
 
 void World::LoopUpdate()
 {
-	// Polls and buffers the events
-	window->PollEvents();
+	// Polls and buffers the events, or blocks until one arrives if idle.
+	// The first frame is drawn without waiting, and readbacks in flight
+	// are checked every frame so they can't block
+	if (waitForEvents && !firstFrame && !ImageExporter::HasPendingReadbacks())
+		window->WaitEvents();
+	else
+		window->PollEvents();
+	firstFrame = false;
+
+	// Hands finished readbacks to the encoders and reports saved files
+	ImageExporter::Update();
 
 	// Computes frame deltaTime in seconds
 	ComputeFrameDeltaTime();
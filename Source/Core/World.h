@@ -23,6 +23,11 @@ class World : public InputController
 
 		virtual double GetLastFrameTime() final;
 
+		// When enabled the loop sleeps until an input event arrives
+		// instead of rendering frames continuously. Worker threads
+		// wake it with glfwPostEmptyEvent
+		virtual void SetWaitForEvents(bool state) final;
+
 	private:
 		void ComputeFrameDeltaTime();
 		void LoopUpdate();
@@ -33,4 +38,6 @@ class World : public InputController
 		double deltaTime;
 		bool paused;
 		bool shouldClose;
+		bool waitForEvents;
+		bool firstFrame;
 };
\ No newline at end of file
@@ -149,9 +149,10 @@ void Laborator7::GrayScale()
 
 void Laborator7::SaveImage(std::string fileName)
 {
-	cout << "Saving image! ";
-	processedImage->SaveToFile((fileName + ".png").c_str());
-	cout << "[Done]" << endl;
+	cout << "Saving image!" << endl;
+	processedImage->SaveToFileAsync((fileName + ".png").c_str(), [](const string &file, bool saved) {
+		cout << (saved ? "Saved " : "Failed to save ") << file << endl;
+	});
 }
 
 // Read the documentation of the following functions in: "Source/Core/Window/InputController.h" or
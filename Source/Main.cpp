@@ -1,4 +1,6 @@
 #include <ctime>
+#include <string>
+#include <vector>
 #include <iostream>
 
 using namespace std;
@@ -11,16 +13,61 @@ int main(int argc, char **argv)
 {
 	srand((unsigned int)time(NULL));
 
+	// Video mode: --video <input> <output> [--segmentation], Y4M files or - for stdin and stdout
+	if (argc > 3 && string(argv[1]) == "--video")
+	{
+		bool segmentation = argc > 4 && string(argv[4]) == "--segmentation";
+		return CartoonFilterDemo::RunVideo(argv[2], argv[3], segmentation) ? 0 : 1;
+	}
+
+	// Out of core mode: --strips <input> <output> [--palette|--kmeans|--segmentation],
+	// binary PPM or PAM files, with the color levels by default
+	if (argc > 3 && string(argv[1]) == "--strips")
+	{
+		string option = argc > 4 ? argv[4] : "";
+		CpuPipeline::Coloring coloring = CpuPipeline::LEVELS;
+		if (option == "--palette")
+			coloring = CpuPipeline::PALETTE;
+		else if (option == "--kmeans")
+			coloring = CpuPipeline::KMEANS;
+		else if (option == "--segmentation")
+			coloring = CpuPipeline::SEGMENTATION;
+		return CartoonFilterDemo::RunStrips(argv[2], argv[3], coloring) ? 0 : 1;
+	}
+
+	// Resampler benchmark: --resize-benchmark <image>
+	if (argc > 2 && string(argv[1]) == "--resize-benchmark")
+	{
+		return CartoonFilterDemo::RunResizeBenchmark(argv[2]) ? 0 : 1;
+	}
+
 	// Create a window property structure
 	WindowProperties wp;
 	wp.resolution = glm::ivec2(1280, 720);
 
+	// Batch mode: --batch <output folder> <images...>
+	bool batch = argc > 3 && string(argv[1]) == "--batch";
+	wp.headless = batch;
+
 	// Init the Engine and create a new window with the defined properties
 	WindowObject* window = Engine::Init(wp);
 
+	// Filter the images offscreen without entering the loop
+	if (batch)
+	{
+		CartoonFilterDemo *demo = new CartoonFilterDemo();
+		demo->RunBatch(vector<string>(argv + 3, argv + argc), argv[2]);
+		delete demo;
+		Engine::Exit();
+		return 0;
+	}
+
 	// Create a new 3D world and start running it
 	World *world = new CartoonFilterDemo();
 	world->Init();
+
+	cout << "Startup time: " << Engine::GetElapsedTime() << "s" << endl;
+
 	world->Run();
 
 	// Signals to the Engine to release the OpenGL context